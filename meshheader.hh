@@ -0,0 +1,143 @@
+#ifndef CLICK_MESHHEADER_HH
+#define CLICK_MESHHEADER_HH
+
+/*
+ * Stateless (mesh) side framing of TCPSpeaker.
+ *
+ * The full format is a 20 byte IP header plus a 20 byte TCP header, of which
+ * the receiver only needs the flow. With MESH_COMPACT, every connection
+ * picks a 16 bit receive tag and advertises it to its peer in a
+ * TCPOPT_MESHTAG option of the full format. Once the peer knows the tag it
+ * sends the compact format instead: a 4 byte click_meshhdr, followed by the
+ * optional fields its mh_vf bits announce, in this order.
+ *
+ * The two formats are told apart by the first nibble: 4 (IPv4) for the
+ * full, MESH_VERSION for the compact one.
+ *
+ * With MESH_AGG, compact packets of several flows going to the same next
+ * hop are sent as one frame: a click_meshhdr with MESH_F_AGG set, the
+ * number of chunks in mh_flags and a zero tag, followed by the chunks,
+ * each a 16 bit length in network order and a compact packet of that many
+ * bytes.
+ *
+ * With MESH_CC, every compact packet carries a click_meshhop behind the
+ * other optional fields: a per speaker sequence number and send time,
+ * from which the receiving speaker learns about loss and queueing on the
+ * hop, and that speaker's own findings about the packets going the other
+ * way, which is the feedback the sender's rate follows. A compact packet
+ * with a zero tag and only MESH_F_HOP carries just the feedback.
+ *
+ * With MESH_ARQ, every compact packet carries a click_mesharq right behind
+ * the fixed header: the sequence number of its first payload byte in the
+ * connection's mesh byte stream, and the receiver side of the same
+ * connection, the bytes handed on in order and the first block held back
+ * for reordering. In the full format th_seq and th_ack carry the first two,
+ * and a TCPOPT_SACK option with a single block the last, if there is one.
+ *
+ * With MESH_FEC, every packet leaving output 0, of either format or an
+ * aggregate frame, gets a click_meshfec in front, told apart by its first
+ * nibble MESH_FEC_VERSION. Packets are sent in blocks, and a block ends
+ * with a repair packet: a click_meshfec with MESH_FEC_REPAIR, followed by
+ * the XOR of the block's packets (without their click_meshfec), each
+ * padded with zeroes to the longest one. With it the receiver rebuilds any
+ * one packet of the block that went missing.
+ */
+
+#include <click/config.h>
+#include <clicknet/tcp.h>
+
+#define MESH_VERSION		0xA
+#define MESH_FEC_VERSION	0xB
+
+/* present bits in the low nibble of mh_vf */
+#define MESH_F_SEQ			0x1		/* click_mesharq */
+#define MESH_F_WIN			0x2		/* uint32_t window in bytes */
+#define MESH_F_HOP			0x4		/* click_meshhop */
+#define MESH_F_AGG			0x8		/* aggregate frame of chunks */
+
+#define MESH_AGG_CHUNKLEN	2		/* length in front of every chunk */
+#define MESH_AGG_MAXCHUNKS	255
+
+/* Stateless signals, in th_flags of the full and mh_flags of the compact
+ * format: the signals the sender still waits to have acknowledged, and the
+ * acknowledgements of the ones it received itself, shifted into the upper
+ * bits. Every signal is resent until it is acknowledged. */
+#define MESH_SIG_MASK		(TH_SYN | TH_FIN | TH_RST)
+#define MESH_SIG_ACK(s)		((s) << 5)
+#define MESH_SIG_ACKED(f)	(((f) >> 5) & MESH_SIG_MASK)
+
+/* experimental TCP option kind (RFC 4727) carrying the receive tag */
+#define TCPOPT_MESHTAG		253
+#define TCPOLEN_MESHTAG		4
+
+/* NOP, NOP and a TCPOPT_SACK option with one block, full format MESH_ARQ */
+#define MESH_ARQ_SACKOPTLEN	12
+
+struct click_meshhdr {
+	uint8_t		mh_vf;		/* MESH_VERSION << 4 | MESH_F_* */
+	uint8_t		mh_flags;	/* stateless TH_* flags */
+	uint16_t	mh_tag;		/* receiver's tag, network order */
+};
+
+#define MESH_FEC_REPAIR		0x1		/* low nibble of mf_vf */
+#define MESH_FEC_NOBLOCK	0xff	/* mf_index of a packet outside any block */
+#define MESH_FEC_MAXLEN		2048	/* longer packets are not protected */
+
+struct click_meshfec {
+	uint8_t		mf_vf;		/* MESH_FEC_VERSION << 4 | MESH_FEC_REPAIR */
+	uint8_t		mf_index;	/* position in the block, repair: packets in it */
+	uint16_t	mf_block;	/* block number, network order, wraps */
+	uint8_t		mf_loss;	/* feedback: share of the peer's packets lost, /256 */
+	uint8_t		mf_pad;
+	uint16_t	mf_len;		/* repair: XOR of the packets' lengths, network order */
+};
+
+/* all in network order */
+struct click_mesharq {
+	uint32_t	ma_seq;		/* first payload byte */
+	uint32_t	ma_ack;		/* next byte we expect of the peer */
+	uint32_t	ma_sack;	/* block received above ma_ack, */
+	uint32_t	ma_sackend;	/* empty if none */
+};
+
+/* all in network order */
+struct click_meshhop {
+	uint16_t	mo_seq;		/* sender's hop sequence number */
+	uint16_t	mo_ts;		/* sender's clock when sent, ms, wraps */
+	uint16_t	mo_lost;	/* feedback: packets found missing, wraps */
+	uint16_t	mo_qdelay;	/* feedback: queueing delay seen, ms */
+};
+
+static inline bool
+mesh_is_compact(const unsigned char *data)
+{
+	return (data[0] >> 4) == MESH_VERSION;
+}
+
+static inline bool
+mesh_is_fec(const unsigned char *data)
+{
+	return (data[0] >> 4) == MESH_FEC_VERSION;
+}
+
+static inline unsigned
+mesh_hdrlen(uint8_t vf)
+{
+	return sizeof(click_meshhdr) + ((vf & MESH_F_SEQ) ? sizeof(click_mesharq) : 0) +
+		((vf & MESH_F_WIN) ? 4 : 0) +
+		((vf & MESH_F_HOP) ? sizeof(click_meshhop) : 0);
+}
+
+/* offset of an optional field behind the fixed header */
+static inline unsigned
+mesh_field_offset(uint8_t vf, uint8_t field)
+{
+	unsigned off = sizeof(click_meshhdr);
+	if (field > MESH_F_SEQ && (vf & MESH_F_SEQ))
+		off += sizeof(click_mesharq);
+	if (field > MESH_F_WIN && (vf & MESH_F_WIN))
+		off += 4;
+	return off;
+}
+
+#endif
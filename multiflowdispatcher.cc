@@ -34,6 +34,12 @@ MultiFlowHandler::MultiFlowHandler(
     _mfd = mfd;
     _direction = direction;
     q_membership = 0; 
+    _weight = 1; 
+    for (int i = 0; i < NUM_PULL_QUEUES; i++) { 
+	_deficit[i] = 0; 
+	_attained[i] = 0; 
+	_level[i] = 0; 
+    }
     StringAccum sa; 
     sa << flowid; 
     for (int inout = 0; inout<=1; inout++){ 
@@ -178,12 +184,25 @@ MultiFlowHandler::set_state(const MFHState new_state, const int input ) {
  *           push|+------+            +--------+| |pull
  *       -------->|hash  |            |pullable|+->-------- 
  *               ||lookup|            |queue   |  |
- *               ||flowid|            |roundrob|  |
+ *               ||flowid|            |DRR     |  |
  *               |+------+            +--------+  |
  *               |                                |
  *               +--------------------------------+
  * </pre>
  * 
+ * The pullable queue is served deficit round robin: the handler at the
+ * head of the queue is pulled until it has sent its weight times QUANTUM
+ * bytes (or ran dry), only then the queue is rotated. A handler that
+ * overdraws its credit with a large packet pays the debt back in the
+ * following rounds. QUANTUM 0 restores plain per-packet round robin.
+ * 
+ * With LAS_LEVELS > 1 the pullable handlers are additionally sorted into
+ * priority levels by the bytes they have sent so far (least attained
+ * service): new flows start at the highest level and sink as they send
+ * LAS_THRESHOLD, 4 * LAS_THRESHOLD, ... bytes. Only the highest non-empty
+ * level is served, except that a level that waited longer than AGING ms
+ * gets a turn, so bulk flows cannot starve.
+ * 
  * Other cases are not yet implemented, but straight forward.
  * TODO: MultiFlowDispatcher should provide a wrapper for pull
  *       outputs, this is a one-liner
@@ -213,34 +232,52 @@ MultiFlowDispatcher::pull(int port)
 { 
 	MultiFlowHandler *mfh = NULL;
 	Packet *p = NULL; 
-	StringAccum sa;   
 
 	if (! is_pullable(port)) {
 		debug_output(VERB_PACKETS, "[%s] mfd::pull port [%d] mfd_queue is empty: nothing to pull", name().c_str(), port); 
 	    goto empty; 
 	}
 
-	while (!p) {
-		mfh = mfd_queue_pull(QID_PULLABLE_BASE + port);
+	while (!p) { 
+		HandlerQueue *hq = pull_queue_select(port); 
+		mfh = hq ? hq->front() : NULL; 
 		if (!mfh) { 
 			debug_output(VERB_PACKETS, "[%s] mfd::pull no mfh exists in the mfd: nothing to pull", name().c_str()); 
 		    goto empty; 
 		}
+		/* a new round for this handler: grant its quantum, if it is
+		 * still in debt afterwards it has to sit this round out */
+		if (_quantum && mfh->_deficit[port] <= 0) { 
+			mfh->_deficit[port] += _quantum * mfh->_weight; 
+			if (mfh->_deficit[port] <= 0) { 
+				hq->rotate(); 
+				continue; 
+			}
+		}
 		p = mfh->pull(port); 
 
 		if (!p) { 
-			debug_output(VERB_PACKETS, "[%s] mfd::pull no mfh exists in the mfd: nothing to pull", name().c_str()); 
+			debug_output(VERB_PACKETS, "[%s] mfd::pull handler ran dry, removing it from the pullable queue", name().c_str()); 
 			mfh_unset_pullable(mfh,port); 
+			continue; 
 		}
+		if (_quantum) 
+			mfh->_deficit[port] -= p->length(); 
+		if (! _quantum || mfh->_deficit[port] <= 0) 
+			hq->rotate(); 
+		las_account(mfh, port, p->length()); 
 	}
 	
-	sa << mfh->flowid(); 
-	debug_output(VERB_PACKETS, "[%s] mfd::pull [%s]\n", name().c_str(), sa.c_str()); 
+	if (debug_enabled(VERB_PACKETS)) { 
+		StringAccum sa;   
+		sa << mfh->flowid(); 
+		debug_output(VERB_PACKETS, "[%s] mfd::pull [%s]\n", name().c_str(), sa.c_str()); 
+	}
 	return p; 
 
 	empty:
-		debug_output(VERB_PACKETS, "[%s] mfd::pull empty: calling notifier.sleep()", name().c_str()); 
-		_empty_note.sleep(); //FIXME: other port may be still pullable 
+		debug_output(VERB_PACKETS, "[%s] mfd::pull port [%d] empty: calling notifier.sleep()", name().c_str(), port); 
+		_empty_note[port].sleep(); 
 		return NULL; 
 }
 
@@ -248,14 +285,28 @@ MultiFlowDispatcher::pull(int port)
 int 
 MultiFlowDispatcher::configure(Vector<String> &conf, ErrorHandler *errh __attribute__((unused)) ) 
 { 
-	_empty_note.initialize(Notifier::EMPTY_NOTIFIER, router()); 
+	for (int i = 0; i < NUM_PULL_QUEUES; i++) 
+		_empty_note[i].initialize(Notifier::EMPTY_NOTIFIER, router()); 
+	_quantum = MFD_DRR_QUANTUM; 
+	_las_levels = 1; 
+	_las_threshold = MFD_LAS_THRESHOLD; 
+	unsigned aging_ms = MFD_LAS_AGING; 
 	// parse out the verbosity paramater as passed to the element on click
 	// invocation
 	if (cp_va_kparse(conf, this, errh, 
 			"VERBOSITY", 0, cpUnsigned, &(_verbosity), 
+			"QUANTUM", 0, cpUnsigned, &_quantum, 
+			"LAS_LEVELS", 0, cpInteger, &_las_levels, 
+			"LAS_THRESHOLD", 0, cpUnsigned, &_las_threshold, 
+			"AGING", 0, cpUnsigned, &aging_ms, 
 			cpIgnoreRest,	
 			cpEnd) < 0) 
 		return -1;
+	if (_las_levels < 1 || _las_levels > MFD_LAS_MAX_LEVELS) 
+		return errh->error("LAS_LEVELS must be between 1 and %d", MFD_LAS_MAX_LEVELS); 
+	if (! _las_threshold) 
+		return errh->error("LAS_THRESHOLD must be positive"); 
+	_las_aging = (aging_ms * CLICK_HZ + 999) / 1000; 
 
 	// following conditional fixes compiler unused var warnings
 	if (&conf == NULL && errh == NULL) { errh = NULL; }
@@ -366,6 +417,115 @@ MultiFlowDispatcher::initialize(ErrorHandler * errh ) {
     return 0; 
 } 
 
+void *
+MultiFlowDispatcher::port_cast(bool isoutput, int port, const char *name) 
+{ 
+    if (isoutput && port >= 0 && port < NUM_PULL_QUEUES 
+	    && strcmp(name, Notifier::EMPTY_NOTIFIER) == 0) 
+	return static_cast<Notifier *>(&_empty_note[port]); 
+    return Element::port_cast(isoutput, port, name); 
+}
+
+/* Pick the queue to serve next on a pull port: the highest non-empty
+ * priority level, unless a lower one has not been served for _las_aging */
+MultiFlowDispatcher::HandlerQueue *
+MultiFlowDispatcher::pull_queue_select(const int port) 
+{ 
+    if (_las_levels == 1) { 
+	HandlerQueue &hq = mfd_queues[QID_PULLABLE_BASE + port]; 
+	return hq.is_empty() ? NULL : &hq; 
+    }
+
+    click_jiffies_t now = click_jiffies(); 
+    int level = -1; 
+    for (int l = 0; l < _las_levels; l++) { 
+	if (pull_queue(port, l).is_empty()) 
+	    continue; 
+	if (level < 0) { 
+	    level = l; 
+	    if (! _las_aging) 
+		break; 
+	} else if (now - _las_served[port][l] >= _las_aging) { 
+	    debug_output(VERB_MFD_QUEUES, "[%s] mfd::pull_queue_select aging: serving level [%d] on port [%d]", name().c_str(), l, port); 
+	    level = l; 
+	    break; 
+	}
+    }
+    if (level < 0) 
+	return NULL; 
+    _las_served[port][level] = now; 
+    return &pull_queue(port, level); 
+}
+
+int
+MultiFlowDispatcher::las_level(uint64_t attained) const 
+{ 
+    int level = 0; 
+    uint64_t limit = _las_threshold; 
+    while (attained >= limit && level < _las_levels - 1) { 
+	level++; 
+	limit <<= 2; 
+    }
+    return level; 
+}
+
+/* Charge len bytes to a handler and move it to a lower priority level once
+ * it has sent enough. It starts the new level with a fresh deficit. */
+void
+MultiFlowDispatcher::las_account(MultiFlowHandler *mfh, const int port, const unsigned len) 
+{ 
+    mfh->_attained[port] += len; 
+    if (_las_levels == 1) 
+	return; 
+
+    int level = las_level(mfh->_attained[port]); 
+    if (level == mfh->_level[port]) 
+	return; 
+    if (mfh->is_q_member(QID_PULLABLE_BASE + port)) { 
+	pull_queue(port, mfh->_level[port]).dequeue(mfh); 
+	mfh->_level[port] = level; 
+	mfh->_deficit[port] = 0; 
+	mfh_set_pullable(mfh, port); 
+    } else { 
+	mfh->_level[port] = level; 
+	mfh->_deficit[port] = 0; 
+    }
+}
+
+/* Set the DRR weight of one flow, written as 
+ * "SADDR SPORT DADDR DPORT WEIGHT" in the direction of the flow's handler */
+int
+MultiFlowDispatcher::write_flow_weight(const String &s, Element *e, void *, ErrorHandler *errh)
+{
+    MultiFlowDispatcher *mfd = (MultiFlowDispatcher *)e; 
+    Vector<String> words; 
+    IPAddress saddr, daddr; 
+    int sport, dport; 
+    unsigned weight; 
+
+    cp_spacevec(s, words); 
+    if (words.size() != 5 
+	    || ! cp_ip_address(words[0], &saddr) || ! cp_integer(words[1], &sport) 
+	    || ! cp_ip_address(words[2], &daddr) || ! cp_integer(words[3], &dport) 
+	    || ! cp_integer(words[4], &weight) 
+	    || sport < 0 || sport > 0xffff || dport < 0 || dport > 0xffff) 
+	return errh->error("expected SADDR SPORT DADDR DPORT WEIGHT"); 
+
+    IPFlowID flowid(saddr, htons(sport), daddr, htons(dport)); 
+    MultiFlowHandler *mfh = mfd->mfd_hash.get(flowid); 
+    if (! mfh) 
+	return errh->error("no such flow"); 
+    mfh->set_weight(weight); 
+    return 0; 
+}
+
+void
+MultiFlowDispatcher::add_handlers()
+{
+    add_data_handlers("quantum", Handler::OP_READ | Handler::OP_WRITE, &_quantum); 
+    add_write_handler("flow_weight", write_flow_weight, (void *)0); 
+}
+
 bool
 MultiFlowDispatcher::run_task(Task * task)
 {
@@ -438,6 +598,9 @@ MultiFlowDispatcher::HandlerQueue::dequeue(MultiFlowHandler *qe)
 		q = NULL; 
 	/* queue has some members left, dequeue */
     } else { 
+		/* the next one moves up if we remove the head */
+		if (q == qe) 
+			q = qe->next[qid]; 
 		qe->next[qid]->prev[qid] = qe->prev[qid];
 		qe->prev[qid]->next[qid] = qe->next[qid];
 		debug_output(VERB_MFD_QUEUES, "[%x] mfd::dequeue: removed qe [%s]", this, qe); 
@@ -449,7 +612,7 @@ MultiFlowDispatcher::HandlerQueue::dequeue(MultiFlowHandler *qe)
 }  
 
 bool
-MultiFlowDispatcher::is_syn(const Packet *) 
+MultiFlowDispatcher::is_syn(const int, const Packet *) 
 { 
     return true; 
 } 
@@ -508,7 +671,7 @@ MultiFlowDispatcher::get_mfh(const int port, const IPFlowID  &flow_id, Packet *
 
 	    debug_output(VERB_DISPATCH, "[%s] no suitable handler found \n", name().c_str());  
 	    
-	    if ( p && ( ! is_syn(p))  ) {  
+	    if ( p && ( ! is_syn(port, p))  ) {  
 		return NULL; 
 	    } 
 
@@ -582,7 +745,10 @@ void
 MultiFlowDispatcher::remove_handler(MultiFlowHandler *mfh) {
 	debug_output(VERB_MFD_QUEUES, "[%s] mfd::remove_handler removing mfh [%x] from all handlerqueues", name().c_str(), mfh);
 	for (int i=0; i<NUM_QUEUES; i++) { 
-		mfd_queues[i].dequeue(mfh); 
+		if (i >= QID_PULLABLE_BASE && i < QID_PULLABLE_BASE + NUM_PULL_QUEUES) 
+			mfh_unset_pullable(mfh, i - QID_PULLABLE_BASE); 
+		else 
+			mfd_queues[i].dequeue(mfh); 
 	}
 	mfd_hash.erase(*(mfh->flowid())); 
 }
@@ -25,11 +25,24 @@
 #define NUM_PULL_QUEUES		2
 #define QID_DELETE      	2
 
+// Verbosity classes that are compiled in at all. Classes outside of this
+// mask cost nothing, not even the verbosity() lookup, e.g. build with
+// -DMFD_DEBUG_MASK=VERB_ERRORS for a lean datapath. 
+#ifndef MFD_DEBUG_MASK
+# define MFD_DEBUG_MASK	VERB_ALL
+#endif
+
+// True if a message of this class would be printed. Use it to guard any
+// formatting (StringAccum etc.) that only feeds debug_output.
+#define debug_enabled(mask) \
+		(((mask) & MFD_DEBUG_MASK) && ((mask) & (verbosity())))
+
 // Check our verbosity bitmask against the supplied bitmask and if true
-// produce the according chatter output
+// produce the according chatter output. The arguments are only evaluated
+// if the message is printed.
 #define debug_output(mask, format, args...) \
-		if ((mask) & (verbosity()))  \
-	    click_chatter((format) ,## args);
+		do { if (debug_enabled(mask))  \
+	    click_chatter((format) ,## args); } while (0)
 #define SPKRNAME speaker()->name().c_str()
 
 // Verbosity Bitmask definitions
@@ -61,6 +74,16 @@
 #define DIR_INBOUND  0 
 #define DIR_OUTBOUND 1
 
+// Default deficit round robin quantum of MultiFlowDispatcher::pull in bytes
+#define MFD_DRR_QUANTUM		1500
+
+// Least attained service: number of priority levels per pull port, bytes a
+// handler may send at the highest level (each level below allows 4 times as
+// many) and ms after which a waiting lower level is served once regardless
+#define MFD_LAS_MAX_LEVELS	8
+#define MFD_LAS_THRESHOLD	10240
+#define MFD_LAS_AGING		100
+
 CLICK_DECLS
 
 class MultiFlowDispatcher;
@@ -99,7 +122,8 @@ class MultiFlowHandler {
     * @return The packet
     * 
     * The default return always NULL. 
-    * Note: There is no empty notifier. Use set_pullable instead.
+    * Note: The handler has no empty notifier of its own, the dispatcher
+    * keeps one per output port. Use set_pullable instead.
     *
     * @sa Element::push set_pullable */
     virtual Packet *pull(const int port) = 0;
@@ -128,6 +152,17 @@ class MultiFlowHandler {
 		return ismember; 
 	} 
 
+    /** @brief the scheduling weight of the handler
+    * 
+    * On every round of the deficit round robin in MultiFlowDispatcher::pull
+    * the handler may send weight * QUANTUM bytes. The default weight is 1. */
+    unsigned weight() const { return _weight; }
+    void set_weight(unsigned w) { _weight = w ? w : 1; }
+
+    /** @brief bytes pulled from the handler through the dispatcher
+    * @param port The pull port */
+    uint64_t attained(int port) const { return _attained[port]; }
+
     protected:
 	// Next 2 lines formerly declared private
     MultiFlowHandler *next[NUM_QUEUES];
@@ -163,12 +198,12 @@ class MultiFlowHandler {
     IPFlowID	   _flowid; 
     int		   q_membership; 
     int		   _direction; 
+    int		   _deficit[NUM_PULL_QUEUES]; /* DRR byte credit per pull port */
+    unsigned	   _weight; 
+    uint64_t	   _attained[NUM_PULL_QUEUES]; /* bytes pulled per port */
+    int		   _level[NUM_PULL_QUEUES];  /* LAS priority level per port */
     MultiFlowDispatcher * _mfd;
 
-
-    /* The signals needed for pull outputs */ 
-    bool _can_pull[2]; 
-
     private: 
     class Port { 
 	public: 
@@ -239,6 +274,13 @@ class MultiFlowDispatcher : public Element {
 	    for ( i = 0; i <=1; i++) { 
 		_output_port_neighbor_port[i] = -2; 
 	    } 
+	    _las_levels = 1; 
+	    for (i = 0; i < NUM_PULL_QUEUES; i++) { 
+		for (int l = 0; l < MFD_LAS_MAX_LEVELS - 1; l++) { 
+		    _las_queues[i][l].set_mfd(this); 
+		    _las_queues[i][l].set_qid(QID_PULLABLE_BASE + i); 
+		}
+	    }
 	} ; 
 	virtual ~MultiFlowDispatcher() {/*FIXME: delete all handlers*/ } ; 
 
@@ -273,6 +315,15 @@ class MultiFlowDispatcher : public Element {
 	*/
 	virtual int initialize(ErrorHandler *errh); 
 
+	virtual void add_handlers(); 
+
+	/** @brief exposes the per-port empty notifiers
+	* 
+	* See Element::port_cast. Each pull output has its own
+	* Notifier::EMPTY_NOTIFIER, so a downstream element only sleeps on
+	* the port it pulls from. */
+	virtual void *port_cast(bool isoutput, int port, const char *name); 
+
 	/** @brief Iterator to all the handlers
 	* 
 	* @return MFHIterator over all registered MultiFlowHandlers
@@ -317,10 +368,10 @@ class MultiFlowDispatcher : public Element {
 
     protected: 
 	// following method was declared const, but g++ ignores this
-	ActiveNotifier * empty_note() { return &_empty_note; }
+	ActiveNotifier * empty_note(const int port) { return &_empty_note[port]; }
 
     private: 
-	ActiveNotifier _empty_note; 
+	ActiveNotifier _empty_note[NUM_PULL_QUEUES]; 
 	/** @brief return a newly generated MultiFlowHandler
 	*
 	* This should always be overwritten to return an object of 
@@ -340,6 +391,7 @@ class MultiFlowDispatcher : public Element {
 
 	/** @brief check whether this packet can create a new connection
 	* 
+	* @param port The input port the packet arrived on
 	* @param packet The packet to check
 	* 
 	* This can be overwritten, if the protocol has dedicated "syn"
@@ -351,7 +403,7 @@ class MultiFlowDispatcher : public Element {
 	* 
 	* 
 	*/
-	virtual bool is_syn(const Packet * ); 
+	virtual bool is_syn(const int port, const Packet * ); 
 
 	/* MultiFlowDispatcher: Stuff for the queues */ 
     protected:
@@ -359,7 +411,7 @@ class MultiFlowDispatcher : public Element {
 
 		public: 
 
-		HandlerQueue() {}; 
+		HandlerQueue() : q(NULL) {}; 
 		HandlerQueue(MultiFlowDispatcher * m, int qi) {
 		   	mfd = m;
 			qid = qi;
@@ -376,6 +428,8 @@ class MultiFlowDispatcher : public Element {
 		void dequeue(MultiFlowHandler *qe); 
 		bool is_empty() { return q ? false : true; }
 		MultiFlowHandler * get(); 
+		MultiFlowHandler * front() { return q; }
+		void rotate() { if (q) q = q->next[qid]; }
 
 	    private:
 
@@ -398,15 +452,40 @@ class MultiFlowDispatcher : public Element {
 	void mfh_unset_pullable(MultiFlowHandler * h, int port);
 	void mfh_set_pullable(MultiFlowHandler * h, int port); 
 	bool is_pullable(const int port) { 
-		debug_output(VERB_DEBUG, "[%s] mfd::is_pullable port [%d]: [%s]", name().c_str(), port, ((! mfd_queues[QID_PULLABLE_BASE + port].is_empty()) ? "true" : "false")); 
-	    return (! mfd_queues[QID_PULLABLE_BASE + port].is_empty()); 
+		bool pullable = false; 
+		for (int l = 0; l < _las_levels && ! pullable; l++) 
+			pullable = ! pull_queue(port, l).is_empty(); 
+		debug_output(VERB_DEBUG, "[%s] mfd::is_pullable port [%d]: [%s]", name().c_str(), port, (pullable ? "true" : "false")); 
+	    return pullable; 
 	}
+
+	/* Least attained service: the pullable handlers of a port are spread
+	 * over _las_levels queues by the bytes they have sent so far. Level 0
+	 * is mfd_queues[QID_PULLABLE_BASE + port], all levels of a port share
+	 * the handlers' next/prev links of that queue. */
+	unsigned las_threshold() const { return _las_threshold; }
 	
 	/*MultiFlowDispatcher: Stuff for the hash */
 
     private: 
 	int _verbosity;
+	unsigned _quantum; 	/* DRR quantum in bytes, 0: one packet per handler */
 	HandlerQueue  mfd_queues[NUM_QUEUES]; 
+
+	int 	 _las_levels; 	/* 1: no size-aware prioritization */
+	unsigned _las_threshold; 
+	unsigned _las_aging; 	/* in jiffies, 0: no aging */
+	HandlerQueue  _las_queues[NUM_PULL_QUEUES][MFD_LAS_MAX_LEVELS - 1]; 
+	click_jiffies_t _las_served[NUM_PULL_QUEUES][MFD_LAS_MAX_LEVELS]; 
+
+	HandlerQueue & pull_queue(const int port, const int level) { 
+	    return level ? _las_queues[port][level - 1] : mfd_queues[QID_PULLABLE_BASE + port]; 
+	}
+	HandlerQueue * pull_queue_select(const int port); 
+	int las_level(uint64_t attained) const; 
+	void las_account(MultiFlowHandler *, const int port, const unsigned len); 
+
+	static int write_flow_weight(const String &, Element *, void *, ErrorHandler *); 
 	HashTable<IPFlowID, MultiFlowHandler*> mfd_hash; 
 /*	IPFlowID 	_mfd_id; *Reused, do not allocate one per packet*/
 	MultiFlowHandler * get_mfh(const int dir, Packet *p); 
@@ -458,16 +537,27 @@ class MultiFlowDispatcher : public Element {
 
 inline void 
 MultiFlowDispatcher::mfh_unset_pullable(MultiFlowHandler *h, const int port) { 
-    mfd_queues[QID_PULLABLE_BASE + port].dequeue(h); 
+    pull_queue(port, h->_level[port]).dequeue(h); 
+    /* an idle handler does not keep its credit, but it keeps its debt */
+    if (h->_deficit[port] > 0) 
+	h->_deficit[port] = 0; 
 }
 
 inline void 
 MultiFlowDispatcher::mfh_set_pullable(MultiFlowHandler *h, const int port) { 
-    mfd_queues[QID_PULLABLE_BASE + port].enqueue(h); 
+    HandlerQueue &hq = pull_queue(port, h->_level[port]); 
+    if (_las_levels > 1 && hq.is_empty()) 
+	_las_served[port][h->_level[port]] = click_jiffies(); 
+    hq.enqueue(h); 
+    if (debug_enabled(VERB_DEBUG)) { 
 	StringAccum sa; 
 	sa << h->flowid();
-	debug_output(VERB_DEBUG, "[%s] mfd::mfh_set_pullable enqueing new mfh [%s] on port [%d], calling wake", name().c_str(), sa.c_str(), port); 
-    _empty_note.wake(); 
+	debug_output(VERB_DEBUG, "[%s] mfd::mfh_set_pullable enqueing new mfh [%s] on port [%d]", name().c_str(), sa.c_str(), port); 
+    }
+    /* only the first handler of a burst wakes the port, the notifier stays
+     * active until pull finds the port empty */
+    if (! _empty_note[port].active()) 
+	_empty_note[port].wake(); 
 }
 
 inline void 
@@ -510,5 +600,39 @@ MultiFlowHandler::verbosity() const {
 } 
 
 
+/** @class TypedMultiFlowHandler
+ * @brief A MultiFlowHandler that knows the type of its dispatcher
+ * 
+ * Derive handlers from TypedMultiFlowHandler<YourDispatcher> instead of
+ * MultiFlowHandler to get mfd() and dispatcher() returning the concrete
+ * dispatcher type without a dynamic_cast. The cast is safe because a
+ * handler is only ever created by its own dispatcher's new_handler. 
+ */
+template <typename D>
+class TypedMultiFlowHandler : public MultiFlowHandler { 
+    public: 
+	TypedMultiFlowHandler(D * mfd, const IPFlowID & flowid, const int direction) 
+	    : MultiFlowHandler(mfd, flowid, direction) { } 
+
+	D * mfd() const { return static_cast<D *>(MultiFlowHandler::mfd()); } 
+
+    protected: 
+	D * dispatcher() const { return static_cast<D *>(MultiFlowHandler::dispatcher()); } 
+}; 
+
+
+/** @class TypedMultiFlowDispatcher
+ * @brief A MultiFlowDispatcher that knows the type of its handlers
+ * 
+ * The counterpart of TypedMultiFlowHandler: handler() returns the handler
+ * an MFHIterator points to as H without a dynamic_cast. 
+ */
+template <typename H>
+class TypedMultiFlowDispatcher : public MultiFlowDispatcher { 
+    public: 
+	static H * handler(const MFHIterator & i) { return static_cast<H *>(i.value()); } 
+}; 
+
+
 CLICK_ENDDECLS
 #endif // CLICK_MULTIFLOWDISPATCHER_HH
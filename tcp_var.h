@@ -53,7 +53,13 @@ struct tcpcb {
 	u_short	t_maxseg;		/* maximum segment size */
 	char	t_force;		/* 1 if forcing out a byte */
 	u_short	t_flags;
-	u_short	t_sl_flags; 	/* flags for the "statelss" side */
+	u_short	t_sl_flags; 	/* stateless signals not yet acknowledged */
+	u_char	t_sl_raised;	/* stateless signals ever raised */
+	u_char	t_sl_rcvd;		/* stateless signals received */
+	u_char	t_sl_ack;		/* received signals still to acknowledge */
+	char	t_sl_send;		/* 1 if signals or acks have to go out */
+	short	t_sl_timer;		/* signal retransmit timer, in slow ticks */
+	short	t_sl_rxtshift;	/* signal retransmissions so far */
 
 #define	TF_ACKNOW	0x0001		/* ack peer immediately */
 #define	TF_DELACK	0x0002		/* ack, but try to delay it */
@@ -65,8 +71,13 @@ struct tcpcb {
 #define	TF_REQ_TSTMP	0x0080		/* have/will request timestamps */
 #define	TF_RCVD_TSTMP	0x0100		/* a timestamp was received in SYN */
 #define	TF_SACK_PERMIT	0x0200		/* other side said I could SACK */
+#define	TF_NEEDFIN		0x0400		/* close once connected (FIN signal) */
+#define	TF_FASTOPEN		0x0800		/* take the data in the peer's SYN */
+#define	TF_TFO_COOKIE	0x1000		/* send a Fast Open cookie in the SYN-ACK */
+#define	TF_TFO_SYNDATA	0x2000		/* our SYN carried data */
 
-	struct tcpiphdr *t_template;	/* skeletal packet for transmit */
+	uint32_t	t_template[10];	/* IP+TCP header for transmit, 32 bytes
+								 * more than the BSD pointer */
 	struct inpcb 	*t_inpcb;		/* back pointer to internet pcb */
 /*
  * The following fields are used as in the protocol specification.
@@ -106,7 +117,10 @@ struct tcpcb {
 	short	t_srtt;				/* smoothed round-trip time */
 	short	t_rttvar;			/* variance in round-trip time */
 	u_short	t_rttmin;			/* minimum rtt allowed */
+	u_short	t_rttupdated;		/* number of rtt samples taken */
 	u_long	max_sndwnd;			/* largest window peer has offered */
+	u_short	t_hc_mss;			/* host cache: mss the peer took last time */
+	u_long	t_hc_cwnd;			/* host cache: initial cwnd, 0 if unknown */
 
 /* out-of-band data */
 	char	t_oobflags;			/* have some */
@@ -251,6 +265,32 @@ struct	tcpstat {
 	u_long	tcps_predack;		/* times hdr predict ok for acks */
 	u_long	tcps_preddat;		/* times hdr predict ok for data pkts */
 	u_long	tcps_pcbcachemiss;
+	u_long	tcps_rcvcoalesced;	/* segments merged into a previous one (GRO) */
+	u_long	tcps_sndnagle;		/* sends held back by the Nagle algorithm */
+	u_long	tcps_sndmeshagg;	/* aggregate mesh frames sent */
+	u_long	tcps_sndmeshchunks;	/* mesh packets sent inside them */
+	u_long	tcps_rcvmeshagg;	/* aggregate mesh frames received */
+	u_long	tcps_slsignals;		/* stateless signals raised */
+	u_long	tcps_slrexmt;		/* stateless signal retransmissions */
+	u_long	tcps_tfo_cookiesent;	/* Fast Open cookies handed out */
+	u_long	tcps_tfo_accepted;	/* SYNs whose data was taken */
+	u_long	tcps_tfo_badcookie;	/* SYNs with a cookie that wasn't valid */
+	u_long	tcps_tfo_syndata;	/* SYNs sent with data */
+	u_long	tcps_tfo_synacked;	/* ... and all of it acknowledged */
+	u_long	tcps_hc_hits;		/* connections seeded from the host cache */
+	u_long	tcps_hc_updates;	/* host cache updates on close */
+	u_long	tcps_arq_rexmt;		/* mesh packets resent (MESH_ARQ) */
+	u_long	tcps_arq_nack;		/* ... because the peer reported them missing */
+	u_long	tcps_arq_timeout;	/* ... because they timed out */
+	u_long	tcps_arq_ackonly;	/* acknowledgement-only mesh packets sent */
+	u_long	tcps_arq_ooo;		/* mesh packets received after a gap */
+	u_long	tcps_arq_dup;		/* duplicate mesh packets received */
+	u_long	tcps_arq_outwin;	/* mesh packets beyond the window dropped */
+	u_long	tcps_arq_giveup;	/* connections dropped after MESH_ARQ_MAXRXT */
+	u_long	tcps_fec_repairs;	/* FEC repair packets sent (MESH_FEC) */
+	u_long	tcps_fec_rebuilt;	/* mesh packets rebuilt from them */
+	u_long	tcps_fec_lost;		/* blocks that lost too many to rebuild */
+	u_long	tcps_fec_dup;		/* duplicate mesh packets dropped */
 };
 
 
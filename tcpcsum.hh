@@ -0,0 +1,122 @@
+#ifndef CLICK_TCPCSUM_HH
+#define CLICK_TCPCSUM_HH
+
+/*
+ * Internet checksum (RFC 1071) helpers for TCPSpeaker.
+ *
+ * All sums are kept in host order of the 16 bit words as they lie in memory,
+ * which the ones-complement sum is invariant to, so partial sums of
+ * separate buffers can be added as long as each buffer starts at an even
+ * offset of the checksummed data. tcps_csum_partial() returns a partial sum
+ * folded to 16 bits; tcps_csum_finish() turns it into the header field.
+ */
+
+#include <click/config.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+# include <immintrin.h>
+#elif defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+/* marks a payload sum that is not known (any valid sum is <= 0xffff) */
+#define TCP_CSUM_UNKNOWN	0xffffffffU
+
+static inline uint32_t
+tcps_csum_fold(uint64_t sum)
+{
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (uint32_t) sum;
+}
+
+static inline uint32_t
+tcps_csum_partial(const void *buf, unsigned len, uint32_t sum0)
+{
+	const unsigned char *p = (const unsigned char *) buf;
+	uint64_t sum = sum0;
+
+	/* The vector loops widen 16 bit words into 32 bit lanes. A lane takes
+	 * at most two words per block, so flushing every 8192 blocks keeps it
+	 * from overflowing. */
+#if defined(__AVX2__)
+	while (len >= 32) {
+		__m256i acc = _mm256_setzero_si256();
+		const __m256i zero = _mm256_setzero_si256();
+		for (int n = 0; len >= 32 && n < 8192; n++, p += 32, len -= 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *) p);
+			acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+			acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+		}
+		uint32_t l[8];
+		_mm256_storeu_si256((__m256i *) l, acc);
+		for (int i = 0; i < 8; i++)
+			sum += l[i];
+	}
+#elif defined(__SSE2__)
+	while (len >= 16) {
+		__m128i acc = _mm_setzero_si128();
+		const __m128i zero = _mm_setzero_si128();
+		for (int n = 0; len >= 16 && n < 8192; n++, p += 16, len -= 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) p);
+			acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+			acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+		}
+		uint32_t l[4];
+		_mm_storeu_si128((__m128i *) l, acc);
+		sum += (uint64_t) l[0] + l[1] + l[2] + l[3];
+	}
+#elif defined(__ARM_NEON)
+	while (len >= 16) {
+		uint32x4_t acc = vdupq_n_u32(0);
+		for (int n = 0; len >= 16 && n < 8192; n++, p += 16, len -= 16)
+			acc = vpadalq_u16(acc, vld1q_u16((const uint16_t *) p));
+		uint64x2_t w = vpaddlq_u32(acc);
+		sum += vgetq_lane_u64(w, 0) + vgetq_lane_u64(w, 1);
+	}
+#endif
+
+	/* scalar: 32 bit words fold to the same ones-complement sum */
+	for (; len >= 4; p += 4, len -= 4) {
+		uint32_t w;
+		memcpy(&w, p, 4);
+		sum += w;
+	}
+	if (len >= 2) {
+		uint16_t w;
+		memcpy(&w, p, 2);
+		sum += w;
+		p += 2;
+		len -= 2;
+	}
+	if (len) {
+		/* odd byte, padded with a zero byte behind it */
+		uint16_t w = 0;
+		memcpy(&w, p, 1);
+		sum += w;
+	}
+	return tcps_csum_fold(sum);
+}
+
+/* add the TCP/UDP pseudo header; addresses are in network order */
+static inline uint32_t
+tcps_csum_pseudo(uint32_t src, uint32_t dst, uint8_t proto, unsigned len,
+	uint32_t sum)
+{
+	uint64_t s = sum;
+	s += (src & 0xffff) + (src >> 16);
+	s += (dst & 0xffff) + (dst >> 16);
+	s += htons(proto) + htons((uint16_t) len);
+	return tcps_csum_fold(s);
+}
+
+static inline uint16_t
+tcps_csum_finish(uint32_t sum)
+{
+	return (uint16_t) ~tcps_csum_fold(sum);
+}
+
+#endif
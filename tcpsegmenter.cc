@@ -0,0 +1,112 @@
+#include <click/config.h>
+#include "tcpsegmenter.hh"
+#include <click/confparse.hh>
+#include <click/error.hh>
+#include <clicknet/ip.h>
+#include <clicknet/tcp.h>
+#include "tcpcsum.hh"
+
+/* 					TCPSegmenter Click Element
+ * ------------------------------------------------------------
+ * Splits the super-segments a TCPSpeaker sends with GSO into segments of
+ * the size in their TCPS_GSO annotation. All header fixing and
+ * checksumming happens here in one pass, instead of once per segment
+ * throughout tcp_output().
+ */
+
+CLICK_DECLS
+
+TCPSegmenter::TCPSegmenter()
+{
+	_checksum = true;
+	_super_segments = _segments = 0;
+}
+
+TCPSegmenter::~TCPSegmenter()
+{
+}
+
+int
+TCPSegmenter::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+	if (cp_va_kparse(conf, this, errh,
+		"CHECKSUM", 0, cpBool, &_checksum,
+		cpEnd) < 0)
+	    return -1;
+	return 0;
+}
+
+void
+TCPSegmenter::push(int, Packet *p)
+{
+	unsigned mss = TCPS_GSO_ANNO(p);
+	const click_ip *iph = p->ip_header();
+
+	if (!mss || !iph) {
+	    output(0).push(p);
+	    return;
+	}
+
+	unsigned iphlen = iph->ip_hl << 2;
+	const click_tcp *th = reinterpret_cast<const click_tcp *>(
+		(const unsigned char *) iph + iphlen);
+	unsigned hlen = iphlen + (th->th_off << 2);
+	unsigned len = ntohs(iph->ip_len);
+
+	if (len <= hlen + mss || (const unsigned char *) iph + len > p->end_data()) {
+	    output(0).push(p);
+	    return;
+	}
+
+	const unsigned char *payload = (const unsigned char *) iph + hlen;
+	unsigned plen = len - hlen;
+	uint32_t seq = ntohl(th->th_seq);
+	uint16_t id = ntohs(iph->ip_id);
+	uint8_t flags = th->th_flags;
+
+	_super_segments++;
+	for (unsigned off = 0; off < plen; off += mss, id++) {
+	    unsigned n = plen - off < mss ? plen - off : mss;
+	    WritablePacket *q = Packet::make(p->headroom(), 0, hlen + n, 0);
+	    if (!q)
+		break;
+
+	    memcpy(q->data(), iph, hlen);
+	    memcpy(q->data() + hlen, payload + off, n);
+	    q->copy_annotations(p);
+	    SET_TCPS_GSO_ANNO(q, 0);
+
+	    click_ip *qiph = reinterpret_cast<click_ip *>(q->data());
+	    q->set_ip_header(qiph, iphlen);
+	    click_tcp *qth = q->tcp_header();
+	    qiph->ip_len = htons(hlen + n);
+	    qiph->ip_id = htons(id);
+	    qth->th_seq = htonl(seq + off);
+	    if (off + n < plen)
+		qth->th_flags = flags & ~(TH_FIN | TH_PUSH);
+
+	    if (_checksum) {
+		unsigned tlen = hlen - iphlen + n;
+		qth->th_sum = 0;
+		uint32_t sum = tcps_csum_partial(qth, tlen, 0);
+		sum = tcps_csum_pseudo(qiph->ip_src.s_addr, qiph->ip_dst.s_addr,
+			IP_PROTO_TCP, tlen, sum);
+		qth->th_sum = tcps_csum_finish(sum);
+		qiph->ip_sum = 0;
+		qiph->ip_sum = tcps_csum_finish(tcps_csum_partial(qiph, iphlen, 0));
+	    }
+	    _segments++;
+	    output(0).push(q);
+	}
+	p->kill();
+}
+
+void
+TCPSegmenter::add_handlers()
+{
+	add_data_handlers("super_segments", Handler::OP_READ, &_super_segments);
+	add_data_handlers("segments", Handler::OP_READ, &_segments);
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(TCPSegmenter)
@@ -0,0 +1,79 @@
+#ifndef CLICK_TCPSEGMENTER_HH
+#define CLICK_TCPSEGMENTER_HH
+#include <click/element.hh>
+
+/*
+=c
+TCPSegmenter(KEYWORDS)
+
+=s tcp
+
+splits TCP super-segments into MSS sized segments
+
+=d
+
+Takes IPv4 TCP packets whose TCPS_GSO annotation is set, as sent by a
+TCPSpeaker with the GSO keyword, and splits them into segments of at most
+that many payload bytes. Each segment gets a copy of the IP and TCP
+headers (options included) with ip_len, ip_id and th_seq adjusted. FIN
+and PSH are only kept on the last segment. Packets without the annotation,
+or that already fit into one segment, are passed on unchanged.
+
+If the output device segments by itself, leave this element out and hand
+it the super-segments together with the annotation.
+
+Keyword arguments are:
+
+=over 8
+
+=item CHECKSUM
+
+Boolean. Fill in the TCP and IP checksums of every segment. Default true.
+
+=back
+
+=h super_segments read-only
+
+Returns the number of packets split so far.
+
+=h segments read-only
+
+Returns the number of segments they were split into.
+
+=a TCPSpeaker
+*/
+
+/* Segment payload size of a super-segment, 0 for ordinary packets. Bytes
+ * 8-9 lie within DST_IP6_ANNO only, which an IPv4 path leaves alone, and
+ * clear of DST_IP (0-3), PAINT (16), ICMP_PARAMPROB (17), VLAN_TCI (22-23),
+ * EXTRA_PACKETS and EXTRA_LENGTH (24-31), AGGREGATE (32-35) and
+ * FIRST_TIMESTAMP (40-47). Overridable for builds that use them otherwise. */
+#ifndef TCPS_GSO_ANNO_OFFSET
+# define TCPS_GSO_ANNO_OFFSET	8
+#endif
+#define TCPS_GSO_ANNO(p)		((p)->anno_u16(TCPS_GSO_ANNO_OFFSET))
+#define SET_TCPS_GSO_ANNO(p, v)	((p)->set_anno_u16(TCPS_GSO_ANNO_OFFSET, (v)))
+
+CLICK_DECLS
+
+class TCPSegmenter : public Element {
+    public:
+	TCPSegmenter();
+	~TCPSegmenter();
+
+	const char *class_name() const	{ return "TCPSegmenter"; }
+	const char *port_count() const	{ return PORTS_1_1; }
+	const char *processing() const	{ return PUSH; }
+
+	int 	configure(Vector<String> &conf, ErrorHandler *errh);
+	void 	add_handlers();
+	void 	push(int port, Packet *p);
+
+    private:
+	bool		_checksum;
+	uint32_t	_super_segments;
+	uint32_t	_segments;
+};
+
+CLICK_ENDDECLS
+#endif
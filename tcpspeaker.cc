@@ -1,4 +1,8 @@
 #include <click/config.h>
+#if CLICK_USERLEVEL
+# include <stdio.h>
+# include <unistd.h>
+#endif
 
 #define TCPTIMERS
 #define TCPOUTFLAGS
@@ -7,9 +11,11 @@
 #include <click/packet_anno.hh>
 #include "tcpspeaker.hh"
 #include "tcpip.h"
+#include "tcpsegmenter.hh"
 #include <click/error.hh>
 #include <click/router.hh>
 #include <click/confparse.hh>
+#include <click/standard/scheduleinfo.hh>
 
 #include <clicknet/ip.h>
 #include <clicknet/tcp.h>
@@ -67,13 +73,50 @@
 CLICK_DECLS
 
 
+/* Header prediction for the options of a non-SYN segment: most stacks send
+ * NOP,NOP,TIMESTAMP as recommended in RFC 1323 appendix A. The three words
+ * are read directly when the options are 32-bit aligned, which they are
+ * behind a plain IP header; only an odd IP header length takes the copy.
+ * Either way there are no unaligned loads, which trap on the ARM boards. */
+static inline bool
+tcp_predict_timestamp(const u_char *cp, unsigned cnt, u_long *ts_val, u_long *ts_ecr)
+{
+	uint32_t words[3]; 
+	const uint32_t *lp; 
+
+	if (cnt != TCPOLEN_TSTAMP_APPA) 
+		return false; 
+	if (((uintptr_t)cp & 3) == 0) { 
+		lp = reinterpret_cast<const uint32_t *>(cp); 
+	} else { 
+		memcpy(words, cp, sizeof(words)); 
+		lp = words; 
+	}
+	if (lp[0] != htonl(TCPOPT_TSTAMP_HDR)) 
+		return false; 
+	*ts_val = ntohl(lp[1]); 
+	*ts_ecr = ntohl(lp[2]); 
+	return true; 
+}
+
+
 inline void 
 TCPConnection::push(const int port, Packet *_p)
 {
+#if TCPSPEAKER_CYCLES
+    click_cycles_t c0 = click_get_cycles(); 
+#endif
     WritablePacket *p = _p->uniqueify(); 
+    if (! tp && ! tcp_attach()) {
+		p->kill(); 
+		return; 
+    }
     if (port == 0) {
 		// Stateful TCP input from outside the mesh
-		tcp_input(p); 
+		if (speaker()->globals()->gro_size) 
+			gro_input(p); 
+		else 
+			tcp_input(p); 
     } else { 
 		// Stateless input from within the mesh 
 		int retval = usrsend(p);
@@ -81,11 +124,113 @@ TCPConnection::push(const int port, Packet *_p)
 			debug_output(VERB_ERRORS, "TCPConnection::usrsend returned an error: [%d]", retval);
 		}
     }
+#if TCPSPEAKER_CYCLES
+    int stat = port == 0 ? TCPS_CYC_INPUT : TCPS_CYC_USRSEND; 
+    speaker()->_cycles.count[stat]++; 
+    speaker()->_cycles.cycles[stat] += click_get_cycles() - c0; 
+#endif
+}
+
+/* GRO: hold on to an in-order data segment, in the hope that its successors
+ * are right behind it and can be merged into it. Anything that doesn't
+ * merge flushes the held segment first, so tcp_input still sees all
+ * segments in arrival order. */
+void
+TCPConnection::gro_input(WritablePacket *p)
+{
+    const click_ip *iph = p->ip_header(); 
+    const click_tcp *th = p->tcp_header(); 
+
+    if (_gro && gro_merge(p)) 
+		return; 
+    gro_flush(); 
+
+    /* only at rcv_nxt: after a loss every out of order segment has to
+     * draw its own duplicate ACK, or fast retransmit comes late */
+    if (tp->t_state == TCPS_ESTABLISHED && th->th_flags == TH_ACK && 
+		ntohl(th->th_seq) == tp->rcv_nxt && iph->ip_hl == 5 && (iph->ip_off & htons(IP_MF | IP_OFFMASK)) == 0 && 
+		ntohs(iph->ip_len) > sizeof(click_ip) + (th->th_off << 2)) { 
+		_gro = p; 
+		_gro_segs = 1; 
+		speaker()->gro_enqueue(this); 
+		return; 
+    }
+    tcp_input(p); 
+}
+
+
+/* Append the payload of <p> to the held segment if it directly follows it
+ * and carries the same ACK, window and options. A PSH ends the merge. */
+bool
+TCPConnection::gro_merge(WritablePacket *p)
+{
+    click_ip *hiph = _gro->ip_header(); 
+    click_tcp *hth = _gro->tcp_header(); 
+    const click_ip *iph = p->ip_header(); 
+    const click_tcp *th = p->tcp_header(); 
+    unsigned hlen = sizeof(click_ip) + (hth->th_off << 2); 
+    unsigned hplen = ntohs(hiph->ip_len) - hlen; 
+    unsigned plen = ntohs(iph->ip_len) - hlen; 
+
+    if ((th->th_flags & ~TH_PUSH) != TH_ACK || iph->ip_hl != 5 || 
+		(iph->ip_off & htons(IP_MF | IP_OFFMASK)) || 
+		th->th_off != hth->th_off || 
+		ntohs(iph->ip_len) <= hlen || 
+		hplen + plen > (unsigned) speaker()->globals()->gro_size || 
+		th->th_seq != htonl(ntohl(hth->th_seq) + hplen) || 
+		th->th_ack != hth->th_ack || th->th_win != hth->th_win || 
+		memcmp(th + 1, hth + 1, hlen - sizeof(click_ip) - sizeof(click_tcp))) 
+		return false; 
+
+    /* the first merge makes room for all of them, not one segment a time */
+    if (_gro->tailroom() < plen) { 
+		WritablePacket *n = Packet::make(_gro->headroom(), _gro->data(), 
+			hlen + hplen, speaker()->globals()->gro_size - hplen); 
+		if (!n) 
+			return false; 
+		n->copy_annotations(_gro); 
+		n->set_ip_header(reinterpret_cast<click_ip *>(n->data()), sizeof(click_ip)); 
+		_gro->kill(); 
+		_gro = n; 
+		hiph = n->ip_header(); 
+		hth = n->tcp_header(); 
+    }
+    _gro = _gro->put(plen); 
+    hiph = _gro->ip_header(); 
+    hth = _gro->tcp_header(); 
+    memcpy(_gro->data() + hlen + hplen, (const u_char *) iph + hlen, plen); 
+    hiph->ip_len = htons(hlen + hplen + plen); 
+    hth->th_flags |= th->th_flags; 
+    _gro_segs++; 
+    p->kill(); 
+
+    if (hth->th_flags & TH_PUSH) 
+		gro_flush(); 
+    return true; 
+}
+
+
+/* Hand the held segment to tcp_input. _gro_segs stays set while it runs,
+ * so a segment standing for several gets its ACK right away. */
+void
+TCPConnection::gro_flush()
+{
+    if (!_gro) 
+		return; 
+    WritablePacket *p = _gro; 
+    _gro = NULL; 
+    speaker()->gro_dequeue(this); 
+    speaker()->_tcpstat.tcps_rcvcoalesced += _gro_segs - 1; 
+    tcp_input(p); 
+    _gro_segs = 0; 
 }
 
+
 inline void 
 TCPConnection::print_tcpstats(WritablePacket *p, char* label)
 {
+    if (! debug_enabled(VERB_TCPSTATS)) 
+	return; 
     const click_tcp *tcph= p->tcp_header();
     const click_ip 	*iph = p->ip_header();
 	int len = ntohs(iph->ip_len) - sizeof(click_ip) - (tcph->th_off << 2); 
@@ -95,39 +240,61 @@ TCPConnection::print_tcpstats(WritablePacket *p, char* label)
 }
 
 
-bool
-TCPConnection::pull_stateless_input(Task * task, void * connection) { 
+/* How many packets to pull from the stateless input in one round: enough to
+ * fill the send window plus one window of lookahead, bounded by the free
+ * slots in the send ring. 0 means the window is full. */
+int
+TCPConnection::pull_quantum() 
+{ 
+	if (! tp || tp->t_state < TCPS_ESTABLISHED || tp->t_state > TCPS_CLOSE_WAIT) 
+		return 0; 
 
-	TCPConnection * con = static_cast<TCPConnection *>(connection); 
+	long wnd = min(tp->snd_wnd, tp->snd_cwnd); 
+	long room = 2 * wnd - (long)_q_usr_input.byte_length(); 
+	int slots = FIFO_SIZE - 1 - _q_usr_input.pkt_length(); 
+	if (room <= 0 || slots <= 0) 
+		return 0; 
 
-	/* If output queue capacity is greater than sender's advertised window, we
-	 * choose not to pull from upstream
-	 */
-	tcp_seq_t fifolen = con->_q_usr_input.byte_length();
-	tcp_seq_t rcvadv = con->tp->rcv_adv;
-	if (fifolen > rcvadv) {
-		click_chatter("[%s] (tcpcon::pull_stateless) Not pulling: Our fifo exceeds adv. win: fifolen:[%u] rcvadv:[%u]", con->SPKRNAME, fifolen, rcvadv);
-		return false; 
+	int quantum = (room + tp->t_maxseg - 1) / tp->t_maxseg; 
+	return min(quantum, min(slots, TCPS_PULL_QUANTUM_MAX)); 
+}
 
+
+/* Pull up to quantum packets from the neighbor handler into the send fifo.
+ * drained is set if the neighbor ran out of packets or usrsend failed. */
+int
+TCPConnection::pull_stateless_input(int quantum, bool &drained) 
+{ 
+	int n; 
+	drained = false; 
+	for (n = 0; n < quantum; n++) { 
+		Packet *p = input(TCPS_STATELESS_INPUT).pull(); 
+		if (! p) { 
+			drained = true; 
+			break; 
+		}
+		if (usrsend(p->uniqueify())) { 
+			drained = true; 
+			n++; 
+			break; 
+		}
 	}
-	 
-	// Try to batch-pull 5 packets (5 is arbitrarily chosen)
-	for (int i=0; i<5; i++) { 
-		if (Packet *p = con->input(TCPS_STATELESS_INPUT).pull()) { 
-			//click_chatter("[%s] (tcpcon::pull_stateless) i:[%u]", con->SPKRNAME, i);
-			WritablePacket *wp = p->uniqueify(); 
-			if (con->usrsend(wp)) { 
-				return false; 
-			} 
-		} else { 
-			return false; 
-		} 
-	}
-	task->fast_reschedule(); 
-	return true; 
+	return n; 
 } 
 
 
+void
+TCPConnection::can_pull(const MultiFlowDispatcher * const neighbor, bool pullable)
+{
+	if (dispatcher()->_output_port_neighbors[TCPS_STATELESS_OUTPUT] != neighbor)
+		return; 
+	if (! pullable) 
+		speaker()->pull_ready_dequeue(this, SPEAKER_Q_NONE); 
+	else if (handler_state() == ACTIVE) 
+		speaker()->pull_ready_enqueue(this); 
+}
+
+
 inline Packet * 
 TCPConnection::pull(const int port)
 {
@@ -136,27 +303,115 @@ TCPConnection::pull(const int port)
 
 	if (port != 0) 
 		return NULL; 
+	/* MESH_ARQ: what the peer is missing goes first, new data only while
+	 * the window is open */
+	if (_arq_resend && (p = arq_resend())) 
+		return p; 
 	// Obtain a WritablePacket containing the next available-to-dispatch TCP segment
-	p = _q_recv.pull_front(); 
+	if (! arq_window_open()) 
+		p = NULL; 
+	else if (speaker()->globals()->mesh_mtu) 
+		p = mesh_repacketize(); 
+	else 
+		p = _q_recv.pull_front(); 
+	/* nothing to send, but signals, acknowledgements or (MESH_COMPACT)
+	 * our tag have to get to the far side */
+	if (!p && (_mesh_adv_signal || (tp && tp->t_sl_send) || _arq_ack_now)) { 
+		if (_arq_ack_now) 
+			speaker()->_tcpstat.tcps_arq_ackonly++; 
+		p = Packet::make(Packet::default_headroom + sizeof(click_ip) + 
+			sizeof(click_tcp) + TCPOLEN_MESHTAG + MESH_ARQ_SACKOPTLEN, 0, 0, 0); 
+	}
 	if (!p) { 
 		debug_output(VERB_PACKETS, "[%s] (tcpcon::pull) No Packet", SPKRNAME);
-		/* If stateless flags were set, create + send a stateless signal packet */
-//		if (tp->t_sl_flags) {
-//			// Make Empty Packet: (headroom, *data, len, tailroom)
-//			p = Packet::make(64, NULL, 0, 0);
-//			p->pull(sizeof(click_ip) + sizeof(click_tcp));
-//			debug_output(VERB_PACKETS, "[%s] tcpcon::pull Making new packet: p [%x] p->data [%x] p->length [%d] p->buflen [%d]",SPKRNAME, p, p->data(), p->length(), p->buffer_length());
-//		// At this point, we really have nothing at all to send
-//		} else {
 		set_pullable(0, false); 
 		return NULL; 
 	}
 
-	stateless_encap(p);
+	if (! speaker()->globals()->mesh_arq) 
+		return stateless_encap(p);
+	tcp_seq_t seq = _arq_nxt; 
+	unsigned len = p->length(); 
+	p = stateless_encap(p, seq); 
+	if (p && len) 
+		arq_retain(p, seq, len); 
 	return p; 
 }
 
 
+/* MESH_MTU: cut the in-order received bytes into mesh packets of the
+ * target size, regardless of how the sender segmented them. Less than
+ * that waits for more data until the deadline, or the peer's FIN. */
+WritablePacket *
+TCPConnection::mesh_repacketize()
+{
+	const tcp_globals *g = speaker()->globals(); 
+	unsigned target = g->mesh_mtu - stateless_hlen() - 
+		(g->mesh_fec ? sizeof(click_meshfec) : 0); 
+	unsigned avail = _q_recv.ordered_bytes(target); 
+
+	if (avail == 0) { 
+		_mesh_flush = false; 
+		return NULL; 
+	}
+	if (avail < target && ! _mesh_flush && speaker()->globals()->mesh_delay && 
+		TCPS_HAVERCVDFIN(tp->t_state) == 0) { 
+		if (! _mesh_waiting) 
+			speaker()->mesh_wait_enqueue(this); 
+		return NULL; 
+	}
+	if (avail < target) 
+		_mesh_flush = false; 
+	/* the wait is over, the next partial packet gets a deadline of its own */
+	if (_mesh_waiting) 
+		speaker()->mesh_wait_dequeue(this); 
+	return _q_recv.pull_bytes(target, Packet::default_headroom + 
+		sizeof(click_ip) + sizeof(click_tcp) + TCPOLEN_MESHTAG + MESH_ARQ_SACKOPTLEN); 
+}
+
+
+
+/* Fill in the TCP and IP checksums of an outgoing segment of <len> bytes
+ * with a 20 byte IP header. With a known payload sum (a whole fifo entry,
+ * also on retransmit) only the headers have to be summed here. */
+static inline void
+tcp_ip_checksum(click_ip *iph, unsigned len, uint32_t payload_sum)
+{
+    click_tcp *th = reinterpret_cast<click_tcp *>(iph + 1); 
+    unsigned tlen = len - sizeof(click_ip); 
+    uint32_t sum; 
+
+    th->th_sum = 0; 
+    if (payload_sum == TCP_CSUM_UNKNOWN) 
+		sum = tcps_csum_partial(th, tlen, 0); 
+    else 
+		sum = tcps_csum_partial(th, th->th_off << 2, payload_sum); 
+    sum = tcps_csum_pseudo(iph->ip_src.s_addr, iph->ip_dst.s_addr, 
+		IP_PROTO_TCP, tlen, sum); 
+    th->th_sum = tcps_csum_finish(sum); 
+
+    iph->ip_sum = 0; 
+    iph->ip_sum = tcps_csum_finish(tcps_csum_partial(iph, sizeof(click_ip), 0)); 
+}
+
+/* Verify the TCP checksum of a received segment (CheckIPHeader in front of
+ * the speaker already covers the IP header) */
+static inline bool
+tcp_input_checksum_ok(const Packet *p)
+{
+    const click_ip *iph = p->ip_header(); 
+    unsigned hlen = iph->ip_hl << 2; 
+    unsigned len = ntohs(iph->ip_len); 
+
+    if (len < hlen + sizeof(click_tcp) || 
+		p->network_header() + len > p->end_data()) 
+		return false; 
+    uint32_t sum = tcps_csum_partial(p->network_header() + hlen, len - hlen, 0); 
+    sum = tcps_csum_pseudo(iph->ip_src.s_addr, iph->ip_dst.s_addr, 
+		IP_PROTO_TCP, len - hlen, sum); 
+    return sum == 0xffff; 
+}
+
 
 // Stateful TCP segment input (recvd packet) handling
 void 
@@ -172,6 +427,9 @@ TCPConnection::tcp_input(WritablePacket *p)
     int 	todrop, acked, ourfinisacked, needoutput = 0;
     struct 	mini_tcpip  ti; 
 //  tcp_seq_t	tseq; 
+#if TCPSPEAKER_CYCLES
+    click_cycles_t cyc; 
+#endif
 
     const click_ip 	*iph = p->ip_header();
     const click_tcp *tcph= p->tcp_header();
@@ -209,17 +467,35 @@ TCPConnection::tcp_input(WritablePacket *p)
     tiflags = ti.ti_flags;
 
     /*293*/
-    if ((tiflags & TH_SYN) == 0) 
+#if TCPSPEAKER_CYCLES
+    cyc = click_get_cycles(); 
+#endif
+    if (_opt_profile && (tiflags & TH_SYN) == 0 && 
+		(this->*_opt_profile->input)(optp, optlen, ti.ti_win, tiwin, 
+			ts_present, ts_val, ts_ecr)) 
+		optp = NULL; 	/* options done */
+    else if ((tiflags & TH_SYN) == 0) 
 		tiwin = ti.ti_win << tp->snd_scale; 
     else
 		tiwin = ti.ti_win;
+#if TCPSPEAKER_CYCLES
+    speaker()->_cycles.cycles[TCPS_CYC_OPTIONS] += click_get_cycles() - cyc; 
+#endif
 
     /*334*/
     tp->t_idle = 0; 
     tp->t_timer[TCPT_KEEP] = speaker()->globals()->tcp_keepidle; 
 
     /*344*/
-	_tcp_dooptions(optp, optlen, tcph, &ts_present, &ts_val, &ts_ecr);
+#if TCPSPEAKER_CYCLES
+    cyc = click_get_cycles(); 
+#endif
+	if (optp) 
+		_tcp_dooptions(optp, optlen, tcph, &ts_present, &ts_val, &ts_ecr);
+#if TCPSPEAKER_CYCLES
+    speaker()->_cycles.cycles[TCPS_CYC_OPTIONS] += click_get_cycles() - cyc; 
+    speaker()->_cycles.count[TCPS_CYC_OPTIONS]++; 
+#endif
 
     /*347 TCP "Fast Path" packet processing */ 
 
@@ -265,6 +541,7 @@ TCPConnection::tcp_input(WritablePacket *p)
 						tcp_xmit_timer((speaker()->tcp_now()) - ts_ecr+1);
 					else if (tp->t_rtt && SEQ_GT(ti.ti_ack, tp->t_rtseq))
 						tcp_xmit_timer(tp->t_rtt);
+					pace_rtt(ti.ti_ack); 
 
 					acked = ti.ti_ack - tp->snd_una;
 					(speaker()->_tcpstat.tcps_rcvackpack)++;
@@ -273,6 +550,7 @@ TCPConnection::tcp_input(WritablePacket *p)
 					// We can now drop data we know was recieved by the other side
 					_q_usr_input.drop_until(acked); 
 					tp->snd_una = ti.ti_ack;
+					stateless_input_unchoke(); 
 					p->kill(); 
 
 					/* If all outstanding data are acked, stop
@@ -331,7 +609,7 @@ TCPConnection::tcp_input(WritablePacket *p)
 				if (has_pullable_data()) { 
 						set_pullable(TCPS_STATELESS_OUTPUT,true); 
 				}
-				tp->t_flags |= TF_DELACK;
+				tp->t_flags |= _gro_segs > 1 ? TF_ACKNOW : TF_DELACK;
 				tcp_output();
 				return;
 			}
@@ -378,6 +656,17 @@ TCPConnection::tcp_input(WritablePacket *p)
 			_tcp_sendseqinit(tp);
 			_tcp_rcvseqinit(tp);
 			tp->t_flags |= TF_ACKNOW;
+
+			/* FASTOPEN: the data of a SYN is only taken with a valid
+			 * cookie, the client sends it again after the handshake
+			 * otherwise */
+			if (ti.ti_len && (tp->t_flags & TF_FASTOPEN)) { 
+				speaker()->_tcpstat.tcps_tfo_accepted++; 
+			} else { 
+				tp->t_flags &= ~TF_FASTOPEN; 
+				ti.ti_len = 0; 
+				tiflags &= ~TH_FIN; 
+			}
 			tcp_set_state(TCPS_SYN_RECEIVED); 
 			tp->t_timer[TCPT_KEEP] = TCPTV_KEEP_INIT; 
 			speaker()->_tcpstat.tcps_accepts++; 
@@ -401,7 +690,15 @@ TCPConnection::tcp_input(WritablePacket *p)
 			/* 554 */
 			if (tiflags & TH_ACK) {
 				tp->snd_una = ti.ti_ack; 
-				if (SEQ_LT(tp->snd_nxt, tp->snd_una))
+				/* FASTOPEN: drop what the server took of the data in our
+				 * SYN, the rest goes out again right away */
+				if (SEQ_GT(tp->snd_una, tp->iss + 1)) 
+					_q_usr_input.drop_until(tp->snd_una - tp->iss - 1); 
+				if ((tp->t_flags & TF_TFO_SYNDATA) && tp->snd_una == tp->snd_max) 
+					speaker()->_tcpstat.tcps_tfo_synacked++; 
+				tp->t_flags &= ~TF_TFO_SYNDATA; 
+				if (SEQ_LT(tp->snd_nxt, tp->snd_una) || 
+					SEQ_LT(tp->snd_una, tp->snd_max))
 					tp->snd_nxt = tp->snd_una; 
 			}
 			tp->t_timer[TCPT_REXMT] = 0; 
@@ -423,6 +720,7 @@ TCPConnection::tcp_input(WritablePacket *p)
 				if (tp->t_rtt) { 
 					tcp_xmit_timer(tp->t_rtt);
 				} 
+				pace_rtt(ti.ti_ack); 
 			} else {
 				tcp_set_state(TCPS_SYN_RECEIVED); 
 			}
@@ -692,6 +990,8 @@ TCPConnection::tcp_input(WritablePacket *p)
 					tp->snd_ssthresh = win * tp->t_maxseg;
 					tp->t_timer[TCPT_REXMT] = 0;
 					tp->t_rtt = 0;
+					_pace_rtt_start = Timestamp(); 
+					_pace_timing = false; 
 					tp->snd_nxt = ti.ti_ack;
 					tp->snd_cwnd = tp->t_maxseg;
 					debug_output(VERB_TCP, "[%s] now: [%u] cwnd: %u, 3 dups, slowstart", SPKRNAME, speaker()->tcp_now(), tp->snd_cwnd);
@@ -737,6 +1037,7 @@ TCPConnection::tcp_input(WritablePacket *p)
 			tcp_xmit_timer(speaker()->tcp_now() - ts_ecr + 1); 
 	    else if (tp->t_rtt && SEQ_GT(ti.ti_ack, tp->t_rtseq))
 			tcp_xmit_timer( tp->t_rtt );
+	    pace_rtt(ti.ti_ack); 
 
 	    /*
 	     * If all outstanding data is acked, stop retransmit
@@ -775,6 +1076,10 @@ TCPConnection::tcp_input(WritablePacket *p)
 	    tp->snd_una = ti.ti_ack; 
 	    if (SEQ_LT(tp->snd_nxt, tp->snd_una))
 		tp->snd_nxt = tp->snd_una; 
+	    stateless_input_unchoke(); 
+	    /* the flow is complete once its last byte and our FIN are acked */
+	    if (ourfinisacked && _created) 
+			speaker()->record_fct(this); 
 
 	    /* 957 */ 
 	    switch (tp->t_state) { 
@@ -859,8 +1164,9 @@ dodata:
 
 		/* begin TCP_REASS */ 
 		if (ti.ti_seq == tp->rcv_nxt && 
-			tp->t_state == TCPS_ESTABLISHED) {
-				tp->t_flags |= TF_DELACK; 
+			(tp->t_state == TCPS_ESTABLISHED || (tp->t_flags & TF_FASTOPEN))) {
+				tp->t_flags &= ~TF_FASTOPEN; 	/* data of a Fast Open SYN */
+				tp->t_flags |= _gro_segs > 1 ? TF_ACKNOW : TF_DELACK; 
 				tp->rcv_nxt += ti.ti_len; 
 				tiflags = ti.ti_flags & TH_FIN; 
 		} 
@@ -978,14 +1284,12 @@ TCPConnection::tcp_output()
 
     int 		idle, sendalot, off, flags;
     unsigned 	optlen, hdrlen;
-    u_char		opt[MAX_TCPOPTLEN];
+    u_char		opt[MAX_TCPOPTLEN];	/* the option builders fill whole words */
     long		len, win;
     click_tcp 	*ti;
     WritablePacket *p;
-
-	for (int i=0; i < MAX_TCPOPTLEN; i++) {
-		opt[i] = 0;
-	}
+    uint32_t	payload_sum; 
+    long		gso, gso_seg; 
 
     /*61*/
     idle = (tp->snd_max == tp->snd_una);
@@ -1004,6 +1308,8 @@ TCPConnection::tcp_output()
 	
 again:
     sendalot = 0;
+    payload_sum = TCP_CSUM_UNKNOWN; 
+    gso_seg = 0; 
     /*71*/
 	/* off is the offset in bytes from the beginning of the send buf of the
 	 * first data byte to send - a.k.a. bytes already sent, but unacked*/
@@ -1011,6 +1317,18 @@ again:
     win = min(tp->snd_wnd, tp->snd_cwnd); 
     flags = tcp_outflags[tp->t_state]; 
 
+    /* our SYN is out, nothing else goes before it is answered or
+     * retransmitted */
+    if ((flags & TH_SYN) && tp->t_state == TCPS_SYN_SENT && 
+		SEQ_GT(tp->snd_nxt, tp->snd_una)) 
+		return; 
+
+    /* GSO: bulk data leaves as one super-segment instead of one pass
+     * through here per MSS */
+    gso = speaker()->globals()->gso_size; 
+    if (gso <= (long) tp->t_maxseg || (flags & (TH_SYN | TH_RST))) 
+		gso = 0; 
+
     /*80*/
     if (tp->t_force) { 
 		if (win == 0) { 
@@ -1037,13 +1355,29 @@ again:
 
     if (_q_usr_input.pkts_to_send(off,win) > 1) { sendalot = 1; }
 
-    if (len > tp->t_maxseg) { len = tp->t_maxseg; }
+    if (len > (gso ? gso : tp->t_maxseg)) { len = gso ? gso : tp->t_maxseg; }
 
     win = so_recv_buffer_space(); 
 
-    /*131 No silly window avoidance, we send all packets imediately */ 
-    if (len) 
-	    goto send; 
+    /*131 Silly window avoidance (Nagle) only with the NAGLE keyword,
+     * otherwise we send all packets imediately. With it, small mesh
+     * payloads wait while data is outstanding and leave as full segments
+     * spanning several fifo entries. */
+    if (len) { 
+		if (! speaker()->globals()->nagle) 
+			goto send; 
+		if (len >= (long) tp->t_maxseg) 
+			goto send; 
+		if (idle && len + off >= (long) _q_usr_input.byte_length()) 
+			goto send; 
+		if (tp->t_force) 
+			goto send; 
+		if (tp->max_sndwnd > 0 && len >= (long) tp->max_sndwnd / 2) 
+			goto send; 
+		if (SEQ_LT(tp->snd_nxt, tp->snd_max)) 
+			goto send; 
+		speaker()->_tcpstat.tcps_sndnagle++; 
+    }
 	
     /*154*/
     if (win > 0) { 
@@ -1105,56 +1439,64 @@ send:
 			if ((tp->t_flags & TF_REQ_SCALE) && 
 				((flags & TH_ACK) == 0 ||
 				 (tp->t_flags & TF_RCVD_SCALE))) { 
-			*((u_long *) (opt + optlen) ) = htonl( //FIXME 4-byte ALIGNMENT problem occurs here
+			uint32_t ws = htonl(
 				TCPOPT_NOP << 24 | 
 				TCPOPT_WSCALE << 16 | 
 				TCPOLEN_WSCALE << 8 |
 				tp->request_r_scale); 
+			memcpy(opt + optlen, &ws, sizeof(ws)); 
 			optlen += 4;
 			}
+
+			if (speaker()->globals()->fastopen) 
+				optlen += tcp_fastopen_output(flags, opt + optlen, len); 
 		}
 	}
 
     /* 253 timestamp generation */
 //	debug_output(VERB_DEBUG, "[%s] timestamp: [%X] [%x] [%x] [%x]", SPKRNAME, (tp->t_flags),((flags & TH_RST) == 0), ((flags & (TH_SYN | TH_ACK)) == TH_SYN),(tp->t_flags & TF_RCVD_TSTMP));
 
-	//HACK FIX TO MAKE TIMESTAMPS GET Printed as the first stmt evalutates false when window scaling is > 0
-    if (((tp->t_flags & (TF_REQ_TSTMP | TF_NOOPT)) == TF_REQ_TSTMP || 1 ) && 
+	/* established connections: the options are the same on every segment */
+    if (_opt_profile && (flags & (TH_SYN | TH_RST)) == 0) { 
+		optlen += (this->*_opt_profile->output)(opt + optlen); 
+    } else if ((tp->t_flags & (TF_REQ_TSTMP | TF_NOOPT)) == TF_REQ_TSTMP && 
 	(flags & TH_RST) == 0 && 
 	((flags & (TH_SYN | TH_ACK)) == TH_SYN || 
 	(tp->t_flags & TF_RCVD_TSTMP))) { 
 		debug_output(VERB_DEBUG, "[%s] timestamp: SETTING TIMESTAMP", SPKRNAME);
-		u_long *lp = (u_long*) (opt + optlen); 
-		*lp++ = htonl(TCPOPT_TSTAMP_HDR); 
-		*lp++ = htonl(speaker()->tcp_now()); 
-		*lp++ = htonl(tp->ts_recent); 
-		optlen += TCPOLEN_TSTAMP_APPA; 
+		optlen += tcp_output_options<true>(opt + optlen); 
     } else { 
-		// Remove this clause after it's been debugged and timestamps are working properly
 		debug_output(VERB_DEBUG, "[%s] timestamp: NOT setting timestamp", SPKRNAME);
 	}
 		
     hdrlen += optlen; 
 
-    if (len > tp->t_maxseg - optlen) { 
+    if (gso && len > tp->t_maxseg - optlen) { 
+		gso_seg = tp->t_maxseg - optlen; 
+		if (len > gso / gso_seg * gso_seg) { 
+			len = gso / gso_seg * gso_seg; 
+			sendalot = 1; 
+		}
+    } else if (len > tp->t_maxseg - optlen) { 
 		len = tp->t_maxseg - optlen; 
 		sendalot = 1; 
     } 
 
     /*278*/
     if (len) {
-		p = _q_usr_input.get(off); 
+		/* a segment may span several (small) fifo entries */
+		p = _q_usr_input.get(off, len, 
+			Packet::default_headroom + sizeof(click_ip) + sizeof(click_tcp) + optlen); 
 		if (!p) { 
 			debug_output(VERB_ERRORS, "[%s] offset [%u] not in fifo!", SPKRNAME, off); 
 			return; 
 		}
-		if (p->length() > len) {
-			p->take(p->length() - len);
-		}
 		if (p->length() < len) { 
 			len = p->length(); 
 			sendalot = 1; 
 		}
+		if (speaker()->globals()->checksum && !gso_seg) 
+			payload_sum = _q_usr_input.payload_csum(off, len); 
 		p = p->push( sizeof(click_ip) + sizeof(click_tcp) + optlen); 
 
 	/*317*/
@@ -1162,10 +1504,8 @@ send:
 		p = Packet::make(sizeof(click_ip) + sizeof(click_tcp) + optlen);
 		/* TODO: errorhandling */
     }
+    memcpy(p->data(), tp->t_template, sizeof(tp->t_template)); 
     ti = reinterpret_cast<click_tcp *>(p->data() + sizeof(click_ip));
-	
-    ti->th_sport = flowid()->dport(); 
-    ti->th_dport = flowid()->sport(); 
 
     /*339*/
     if (flags & TH_FIN && tp->t_flags & TF_SENTFIN && 
@@ -1228,6 +1568,12 @@ send:
 				tp->t_rtt = 1;
 				tp->t_rtseq = startseq;
 			}
+			/* the clock starts when the pacer lets it go, which it
+			 * only sees for segments with data */
+			if (speaker()->globals()->pacing && len > 0 && ! _pace_timing) { 
+				_pace_timing = true; 
+				_pace_rtseq = startseq; 
+			}
 		}
 
 		if (tp->t_timer[TCPT_REXMT] == 0 && tp->snd_nxt != tp->snd_una) {
@@ -1245,7 +1591,11 @@ send:
 
 	// THE MAGIC MOMENT! Our beloved tcp data segment goes to be wrapped in IP and
 	// sent to its tcp-speaking destination :-)
-    ip_output(p);
+    /* always set: segments cloned from mesh packets carry their annotations */
+    SET_TCPS_GSO_ANNO(p, gso_seg && len > gso_seg ? gso_seg : 0); 
+    ip_output(p, payload_sum);
+    if (gso_seg && len > gso_seg) 	/* the IP ids the segmenter hands out */
+		speaker()->_ip_id += (len - 1) / gso_seg; 
 
 
 	/* Data has been sent out at this point. If we advertised a positive window
@@ -1272,6 +1622,7 @@ TCPConnection::tcp_respond(tcp_seq_t ack, tcp_seq_t seq, int flags)
 	int tlen; 
 
 	WritablePacket *p = Packet::make(sizeof(click_ip) + sizeof(click_tcp)); 
+	memcpy(p->data(), tp->t_template, sizeof(tp->t_template)); 
 	p->set_network_header(p->data(), sizeof(click_ip)); 
 	click_tcp *th = p->tcp_header(); 
 
@@ -1286,16 +1637,9 @@ TCPConnection::tcp_respond(tcp_seq_t ack, tcp_seq_t seq, int flags)
 	    th->th_win = htons((u_short)win); 
 	}
 	
-/*	setports(th->th_sport, _con_id._ports); */
-	th->th_dport = flowid()->sport(); 
-	th->th_sport = flowid()->dport(); 
-	th->th_flags2 = 0; 
 	th->th_seq =   htonl(seq); 
 	th->th_ack =   htonl(ack); 
 	th->th_flags = flags; 
-	th->th_urp = 0; 
-	th->th_sum = 0; 
-	th->th_off = (sizeof(click_tcp)) >> 2;
 	ip_output(p); 
 }
 
@@ -1307,6 +1651,8 @@ TCPConnection::so_recv_buffer_space() {
 
 void 
 TCPConnection::fasttimo() { 
+	if (! tp) 
+		return; 
 	if ( tp->t_flags & TF_DELACK) { 
 		tp->t_flags &= ~TF_DELACK; 
 		tp->t_flags |= TF_ACKNOW; 
@@ -1317,6 +1663,8 @@ TCPConnection::fasttimo() {
 void 
 TCPConnection::slowtimo() { 
 	int i; 
+	if (! tp) 
+		return; 
 	debug_output(VERB_TIMERS, "[%s] now: [%u] Timers: %s %d %s %d %s %d %s %d %s %d", 
 	SPKRNAME,
 	speaker()->tcp_now(), 
@@ -1330,15 +1678,30 @@ TCPConnection::slowtimo() {
 	  // debug_output(VERB_TCP, "%u: TCPConnection::slowtimo: %s %d\n", speaker()->tcp_now(), tcptimers[i], tp->t_timer[i]); 
 		if ( tp->t_timer[i] && --(tp->t_timer[i]) == 0) { 
 		  StringAccum sa;
-		  sa << *(flowid()); 
+		  if (debug_enabled(VERB_TIMERS)) 
+		    sa << *(flowid()); 
 
 		    debug_output(VERB_TIMERS, "[%s] now: [%u] TIMEOUT %s: %s, now: %u", SPKRNAME, speaker()->tcp_now(), sa.c_str(), tcptimers[i], speaker()->tcp_now()); 
 		    tcp_timers(i); 
 		} 
 	}
+	if (tp->t_sl_timer && --tp->t_sl_timer == 0) 
+		stateless_signal_timeout(); 
 	tp->t_idle++; 
 	if (tp->t_rtt) 
 	    tp->t_rtt++;
+	tcp_release_idle(); 
+}
+
+/* Hand back what an idle connection does not need: the send ring once
+ * everything in it has been acknowledged. It is recreated on the next push. */
+void
+TCPConnection::tcp_release_idle() 
+{ 
+	if (tp->t_idle < TCP_IDLE_RELEASE) 
+		return; 
+	if (_q_usr_input.is_allocated() && _q_usr_input.is_empty()) 
+		_q_usr_input.release(); 
 }
 
 int	tcp_backoff[TCP_MAXRXTSHIFT + 1] =
@@ -1404,6 +1767,8 @@ dropit:
 		  }
 		  tp->snd_nxt = tp->snd_una; 
 		  tp->t_rtt = 0; 
+		  _pace_rtt_start = Timestamp(); 
+		  _pace_timing = false; 
 		  { 
 		    u_int win = min(tp->snd_wnd, tp->snd_cwnd)
 		    		/ 2 / tp->t_maxseg; 
@@ -1437,7 +1802,7 @@ TCPConnection::tcp_setpersist() {
 	t = ((tp->t_srtt >> 2) + tp->t_rttvar) >> 1; 
 
 	if (tp->t_timer[TCPT_REXMT]) 
-	    _errh->error("tcp_output REXMT"); 
+	    speaker()->error_handler()->error("tcp_output REXMT"); 
 	
 	TCPT_RANGESET(tp->t_timer[TCPT_PERSIST], 
 		t * tcp_backoff[tp->t_rxtshift], 
@@ -1489,6 +1854,7 @@ TCPConnection::tcp_xmit_timer(short rtt) {
 	}
 	tp->t_rtt = 0;
 	tp->t_rxtshift = 0;
+	tp->t_rttupdated++;
 
 	/*
 	 * the retransmit should happen at rtt + 4 * rttvar.
@@ -1535,204 +1901,738 @@ TCPConnection::tcp_mss(u_int offer) {
 	} else { 
 		mss = glbmaxseg;
 	}
-	tp->t_maxseg = mss;
-	tp->snd_cwnd = mss; 
+	/* HOSTCACHE: until the peer offers one, send what it took last time,
+	 * and start from the window we ended with. Once the handshake timed
+	 * out that window is forgotten, the path is not what it was. */
+	if (tp->t_rxtshift) 
+		tp->t_hc_cwnd = 0; 
+	tp->t_maxseg = (! offer && tp->t_hc_mss) ? min(mss, (u_int) tp->t_hc_mss) : mss;
+	tp->snd_cwnd = max((u_long) tp->t_maxseg, tp->t_hc_cwnd); 
 	debug_output(VERB_TCP, "[%s] now: [%u] cnwd: [%u] rcvd_offer: [%u] tcp_mss: [%u]", SPKRNAME, speaker()->tcp_now(), tp->snd_cwnd, offer, tp->t_maxseg); 
 
 	return mss; 
 }
 
 
-/* Take a segment from q_recv FIFO, wrap it in stateless tcp and ip headers */
-int
-TCPConnection::stateless_encap(WritablePacket *p)
+/* Length of the stateless header stateless_encap puts in front of our next
+ * mesh packet */
+unsigned
+TCPConnection::stateless_hlen() const
 { 
-    uint32_t hlen = sizeof(click_ip) + sizeof(click_tcp); 
+	const tcp_globals *g = speaker()->globals(); 
 
-	// Push extra bytes for click ip and tcp headers onto a headerless packet
-    p = p->push(hlen); 
-    p->set_network_header(p->data(), sizeof(click_ip)); 
+	if (_mesh_stag_ok) 
+		return mesh_hdrlen((g->mesh_arq ? MESH_F_SEQ : 0) | 
+			(g->mesh_cc ? MESH_F_HOP : 0)); 
+	return sizeof(click_ip) + sizeof(click_tcp) + (_mesh_adv ? TCPOLEN_MESHTAG : 0) + 
+		(g->mesh_arq && _arq_sack != _arq_sack_end ? MESH_ARQ_SACKOPTLEN : 0); 
+}
+
+
+/* Take a segment from q_recv FIFO, wrap it in stateless tcp and ip headers,
+ * or in a compact mesh header once we know the peer's tag. With MESH_ARQ,
+ * its payload starts at <arq_seq>. Returns the packet, which may have
+ * moved, or NULL if it had to be dropped. */
+WritablePacket *
+TCPConnection::stateless_encap(WritablePacket *p, tcp_seq_t arq_seq)
+{ 
+	bool arq = speaker()->globals()->mesh_arq; 
+
+	if (_mesh_stag_ok) { 
+		bool hop = speaker()->globals()->mesh_cc; 
+		uint8_t vf = (MESH_VERSION << 4) | (arq ? MESH_F_SEQ : 0) | 
+			(hop ? MESH_F_HOP : 0); 
+		p = p->push(mesh_hdrlen(vf)); 
+		if (! p) 
+			return NULL; 
+		click_meshhdr *mh = reinterpret_cast<click_meshhdr *>(p->data()); 
+		mh->mh_vf = vf; 
+		mh->mh_flags = stateless_signal_output(); 
+		mh->mh_tag = htons(_mesh_stag); 
+		if (arq) 
+			arq_stamp(reinterpret_cast<click_mesharq *>( 
+				p->data() + mesh_field_offset(vf, MESH_F_SEQ)), arq_seq); 
+		if (hop) 
+			speaker()->mesh_hop_stamp(reinterpret_cast<click_meshhop *>( 
+				p->data() + mesh_field_offset(vf, MESH_F_HOP))); 
+		p->set_network_header(p->data(), 0); 
+		p->set_dst_ip_anno(flowid()->daddr());
+		return p; 
+	}
 
-    click_ip	*iph = p->ip_header(); 
-    click_tcp 	*tcph= p->tcp_header(); 
+    uint32_t hlen = stateless_hlen(); 
 
+	// Push extra bytes for click ip and tcp headers onto a headerless packet
+    p = p->push(hlen); 
+    if (! p) 
+		return NULL; 
+    /* built per packet rather than kept in the tcpcb like t_template, so
+     * idle connections don't pay for a second one; aligned as that is */
+    uint32_t	tmpl[10]; 
+    click_ip	*iph = reinterpret_cast<click_ip *>(tmpl); 
+    click_tcp	*th = reinterpret_cast<click_tcp *>(iph + 1); 
+    memset(tmpl, 0, sizeof(tmpl)); 
     iph->ip_v = 4;
-    iph->ip_hl = 5;
-    iph->ip_tos = 0x00; 
-    iph->ip_len = htons(p->length());
-    iph->ip_id = speaker()->get_and_increment_ip_id();
+    iph->ip_hl = sizeof(click_ip) >> 2;
     iph->ip_off = htons(IP_DF);
     iph->ip_ttl = 255;
     iph->ip_p = IP_PROTO_TCP;
-    iph->ip_sum = 0 ; 
-	
-	
-	/* BUG: on arm (i.e. Openwrt on Avilas), the assignement operation below
-	 * causes a not-aligned memory access. Example: if flowid()->saddr() returns
-	 * 10.1.2.3 => 2.3.10.1 will be the value in iph->ip_src
-	 * run with VERB_DEBUG output for more details - this is fixed by using
-	 * echo 2 > /proc/cpu/alignment on OpenWRT
-	 */
-
     iph->ip_src = flowid()->saddr(); 
     iph->ip_dst = flowid()->daddr(); 
+    th->th_sport = flowid()->sport(); 
+    th->th_dport = flowid()->dport(); 
+    memcpy(p->data(), tmpl, sizeof(tmpl)); 
+    p->set_network_header(p->data(), sizeof(click_ip)); 
 
+    iph = p->ip_header(); 
+    iph->ip_len = htons(p->length());
+    iph->ip_id = speaker()->get_and_increment_ip_id();
     p->set_dst_ip_anno(IPAddress(iph->ip_dst));
 
-	/* Zero out the tcph */
-    memset(tcph, 0, sizeof(click_tcp)); 
+    /* MESH_COMPACT: advertise our receive tag until the peer uses it */
+    u_char *opt = p->data() + sizeof(click_ip) + sizeof(click_tcp); 
+    if (_mesh_adv) { 
+		opt[0] = TCPOPT_MESHTAG; 
+		opt[1] = TCPOLEN_MESHTAG; 
+		opt[2] = _mesh_rtag >> 8; 
+		opt[3] = _mesh_rtag & 0xff; 
+		opt += TCPOLEN_MESHTAG; 
+		_mesh_adv_signal = false; 
+    }
+    /* MESH_ARQ: sequence and acknowledgement numbers where TCP has them,
+     * the block we hold back in a SACK option */
+    if (arq) { 
+		click_mesharq ma; 
+		arq_stamp(&ma, arq_seq); 
+		p->tcp_header()->th_seq = ma.ma_seq; 
+		p->tcp_header()->th_ack = ma.ma_ack; 
+		if (ma.ma_sack != ma.ma_sackend) { 
+			opt[0] = opt[1] = TCPOPT_NOP; 
+			opt[2] = TCPOPT_SACK; 
+			opt[3] = MESH_ARQ_SACKOPTLEN - 2; 
+			memcpy(opt + 4, &ma.ma_sack, 2 * sizeof(uint32_t)); 
+		}
+    }
+    p->tcp_header()->th_off = (hlen - sizeof(click_ip)) >> 2; 
 
-	// tp->t_sl_flags = [stateless tcp flags from tcpcb]
-	// The idea here is that we have a stateless tcp flag in the stateless tcp
-	// header, which can indicate signalling between tcpspeakers. These flags
-	// are written to the packet here. 
-    //tcph->th_flags = tp->t_sl_flags; 
-    tcph->th_sport = flowid()->sport(); 
-    tcph->th_dport = flowid()->dport(); 
-    tcph->th_off = sizeof(click_tcp) >> 2; 
+	// The stateless tcp flags carry the signalling between tcpspeakers
+    p->tcp_header()->th_flags = stateless_signal_output(); 
 
     /*TODO: set window-size to free space in _q_usr_input */
-    /*TODO: set flags */ 
     /*TODO: support mss */ 
-    return 0; 
+    return p; 
 }
 
 
+/* MESH_COMPACT: look for the peer's receive tag in the options of a full
+ * format mesh packet. Learning it (again) makes us send compact headers, and
+ * if the peer doesn't know ours yet, it has to hear from us at least once.
+ * MESH_ARQ: copy the block of a SACK option into <ma>, if given. */
+void
+TCPConnection::mesh_input_options(const click_tcp *th, click_mesharq *ma)
+{ 
+	const u_char *cp = reinterpret_cast<const u_char *>(th + 1); 
+	int cnt = (th->th_off << 2) - sizeof(click_tcp); 
+	int optlen; 
 
-/* Take a stateless packet from the mesh, and remove its ip and (either tcp or)
- * udp headers. If the payload of the packet is 0 bytes, we have decapsulated a
- * stateless signaling packet, and we should process the header accordingly. We
- * return the length of the payload of the packet. Length 0 means that the
- * packet has no payload, only stateless headers.
- */
-int
-TCPConnection::stateless_decap(WritablePacket *p) { 
-
-	if (! p->network_header()) 
-	    return 0;
-
-	unsigned int hlen = 0;
-	hlen += sizeof(click_ip);
-	
-	switch (p->ip_header()->ip_p) { 
-		case IP_PROTO_TCP: 
-			hlen += (p->tcp_header()->th_off << 2); 
+	for (; cnt > 0; cnt -= optlen, cp += optlen) { 
+		if (cp[0] == TCPOPT_EOL) 
 			break; 
-		case IP_PROTO_UDP: 
-			hlen += sizeof(click_udp); 
+		if (cp[0] == TCPOPT_NOP) { 
+			optlen = 1; 
+			continue; 
+		}
+		if (cnt < 2 || cp[1] < 2 || cp[1] > cnt) 
 			break; 
-	}
-
-	// Set any stateless syn/fin/rst flags
-	//tp->t_sl_flags &= p->tcp_header()->th_flags;
+		optlen = cp[1]; 
+		if (cp[0] == TCPOPT_SACK && ma && optlen >= MESH_ARQ_SACKOPTLEN - 2) { 
+			memcpy(&ma->ma_sack, cp + 2, 2 * sizeof(uint32_t)); 
+			continue; 
+		}
+		if (cp[0] != TCPOPT_MESHTAG || optlen != TCPOLEN_MESHTAG || ! _mesh_rtag) 
+			continue; 
 
-	/* Packet has payload */ 
-	if (hlen < p->length()) {
-	    p->pull(hlen); 
-	    return hlen; 
-	/* Payloadless signal packet */ 
-	} else if (hlen == p->length()) { 
-		debug_output(VERB_TCP, "[%s] tcpcon::st_decap recieved a payloadless tcp segment (probably a signal segment)", SPKRNAME);
-	    p->kill(); 
-		p = NULL;
-	    return 0; 
-	} else {
-		// EINVAL means Error Invalid. man errno :-)
-	    return -EINVAL; 
+		uint16_t tag = (cp[2] << 8) | cp[3]; 
+		if (! tag || (_mesh_stag_ok && tag == _mesh_stag)) 
+			continue; 
+		_mesh_stag = tag; 
+		_mesh_stag_ok = true; 
+		if (_mesh_adv) { 
+			_mesh_adv_signal = true; 
+			set_pullable(TCPS_STATELESS_OUTPUT, true); 
+		}
 	}
 }
 
 
-/* Recieves a stateless mesh packet, passess it to have its headers removed, and
- * then if the packet has a payload, pushes it into the FIFO to be pushed to the
- * stateful reciever, OR if any stateless flags were set, performs the
- * appropriate action.
- */
-int 
-TCPConnection::usrsend(WritablePacket *p)
+
+/* Raise a stateless signal, once per connection. It goes out with the next
+ * mesh packet, a payloadless one if there is no data. */
+void
+TCPConnection::stateless_signal(uint8_t sig)
 { 
-	// Sanity Check: We should never recieve a packet after our tcp state is
-	// beyond CLOSE_WAIT.
-    if (tp->t_state > TCPS_CLOSE_WAIT) { 
-		p->kill(); 
-		return -3; 
-    }
+	if (tp->t_sl_raised & sig) 
+		return; 
+	tp->t_sl_raised |= sig; 
+	tp->t_sl_flags |= sig; 
+	tp->t_sl_send = 1; 
+	tp->t_sl_rxtshift = 0; 
+	speaker()->_tcpstat.tcps_slsignals++; 
+	set_pullable(TCPS_STATELESS_OUTPUT, true); 
+}
 
-    if (tp->so_flags & SO_FIN_AFTER_UDP_IDLE) {
-		debug_output(VERB_TIMERS, "[%s] tcpcon::usrsend setting timer TCPT_IDLE to [%d]", 
-			SPKRNAME, speaker()->globals()->so_idletime); 
-		tp->t_timer[TCPT_IDLE] = speaker()->globals()->so_idletime;  
-	}
 
-	// the stateless tcp flags field from the recieved stateless packet
-	int retval = 0 ; 
-	retval = stateless_decap(p); 
+/* The flags of a mesh packet we send: our outstanding signals and the
+ * acknowledgements of the far side's. FIN waits for the last data. */
+uint8_t
+TCPConnection::stateless_signal_output()
+{ 
+	uint8_t f = tp->t_sl_flags & MESH_SIG_MASK; 
+
+	/* MESH_ARQ: also for the last data to be acknowledged */
+	if (has_pullable_data() || _arq_head) 
+		f &= ~TH_FIN; 
+	f |= MESH_SIG_ACK(tp->t_sl_ack); 
+	tp->t_sl_ack = 0; 
+	tp->t_sl_send = 0; 
+	if ((f & MESH_SIG_MASK) && ! tp->t_sl_timer) 
+		tp->t_sl_timer = TCPTV_SL_REXMT; 
+	return f; 
+}
 
-	// A problem occurred while removing the stateless packet header
-    if (retval < 0) {
-		debug_output(VERB_ERRORS, "[%s] TCPConnection::stateless_decap returned an error: [%d]", SPKRNAME, retval);
-		return retval; 
+
+/* Process the flags of a received mesh packet: drop what the far side
+ * acknowledged, acknowledge its signals (again, if they were resent), and
+ * return the ones that are new to us. */
+uint8_t
+TCPConnection::stateless_signal_input(uint8_t sl_flags)
+{ 
+	uint8_t acked = MESH_SIG_ACKED(sl_flags) & tp->t_sl_flags; 
+	uint8_t sig = sl_flags & MESH_SIG_MASK; 
+
+	if (acked) { 
+		tp->t_sl_flags &= ~acked; 
+		if (! (tp->t_sl_flags & MESH_SIG_MASK)) { 
+			tp->t_sl_timer = 0; 
+			tp->t_sl_rxtshift = 0; 
+		}
 	}
- 
-	// If we were closed or listening, we will have to send a SYN 
-    if ((tp->t_state == TCPS_CLOSED) || (tp->t_state == TCPS_LISTEN)) {
-		tcp_set_state(TCPS_SYN_SENT);
+	if (sig) { 
+		tp->t_sl_ack |= sig; 
+		tp->t_sl_send = 1; 
+		set_pullable(TCPS_STATELESS_OUTPUT, true); 
 	}
+	sig &= ~tp->t_sl_rcvd; 
+	tp->t_sl_rcvd |= sig; 
+	return sig; 
+}
 
-	if (tp->t_sl_flags == TH_SYN) {
-		usropen();
-	}
 
-	if (tp->t_sl_flags == TH_FIN) {
-		usrclosed();
+/* Resend unacknowledged signals, until the far side seems to be gone */
+void
+TCPConnection::stateless_signal_timeout()
+{ 
+	if (++tp->t_sl_rxtshift > TCP_SL_MAXRXT) { 
+		debug_output(VERB_TCP, "[%s] giving up on stateless signals [%x]", SPKRNAME, tp->t_sl_flags); 
+		tp->t_sl_flags = 0; 
+		tp->t_sl_rxtshift = 0; 
+		return; 
 	}
+	speaker()->_tcpstat.tcps_slrexmt++; 
+	tp->t_sl_send = 1; 
+	set_pullable(TCPS_STATELESS_OUTPUT, true); 
+}
 
-	// The packet was successfully decapsulated
-	if (p && retval > 0) {
-		retval = _q_usr_input.push(p); 
-	}
 
-	//  These are the states where we expect to recieve packets
-	//	if ( (tp->t_state == TCPS_ESTABLISHED) || ( tp->t_state == TCPS_CLOSE_WAIT ))
-	tcp_output(); 
-    return retval;
+
+/* MESH_ARQ: new data may only go out while less than MESH_ARQ_WINDOW
+ * bytes are unacknowledged */
+bool
+TCPConnection::arq_window_open() const
+{ 
+	const tcp_globals *g = speaker()->globals(); 
+	return ! g->mesh_arq || _arq_nxt - _arq_una < g->mesh_arq_window; 
 }
 
-/* user request 424*/
-void 
-TCPConnection::usrclosed() 
+
+/* MESH_ARQ: fill in the sequence numbers of a mesh packet whose payload
+ * starts at <seq>. It acknowledges all we have, no need for another. */
+void
+TCPConnection::arq_stamp(click_mesharq *ma, tcp_seq_t seq)
 { 
-    switch (tp->t_state) { 
-		case TCPS_CLOSED:
-		case TCPS_LISTEN:
-		case TCPS_SYN_SENT:
-			tcp_set_state(TCPS_CLOSED);
-			break;
-		case TCPS_SYN_RECEIVED:
-		case TCPS_ESTABLISHED:
-			tcp_set_state(TCPS_FIN_WAIT_1);
-			break;
-		case TCPS_CLOSE_WAIT:
-			tcp_set_state(TCPS_LAST_ACK); 
-			break;
-    }
-    tcp_output();
+	ma->ma_seq = htonl(seq); 
+	ma->ma_ack = htonl(_arq_rcv_nxt); 
+	ma->ma_sack = htonl(_arq_sack); 
+	ma->ma_sackend = htonl(_arq_sack_end); 
+	_arq_unacked = 0; 
+	_arq_ack_now = false; 
 }
 
 
-void 
-TCPConnection::usropen() 
+/* MESH_ARQ: keep the <len> payload bytes of the mesh packet we just built
+ * until the peer acknowledges them. The clone shares the packet's data,
+ * which is only copied if it has to be resent. */
+void
+TCPConnection::arq_retain(Packet *p, tcp_seq_t seq, unsigned len)
 { 
-	if (tp->iss == 0) {
-		tp->iss = 0x11111111; 
-		debug_output(VERB_ERRORS, "Setting initial sequence to [%d], because it was 0", tp->iss);
-		// Setting a non-zero initial sequence number because I see some weird
-		// problems in wireshark when initial seq is 0
-	}
+	_arq_nxt = seq + len; 
+	Packet *c = p->clone(); 
+	if (! c) 
+		return; 
+	c->pull(c->length() - len); 
+
+	tcp_arqseg *s = new tcp_arqseg; 
+	s->p = c; 
+	s->seq = seq; 
+	s->sent = Timestamp::now(); 
+	s->rxt = 0; 
+	s->sacked = s->resend = false; 
+	s->next = NULL; 
+	if (_arq_tail) 
+		_arq_tail->next = s; 
+	else 
+		_arq_head = s; 
+	_arq_tail = s; 
+	speaker()->arq_enqueue(this); 
+}
+
+
+/* MESH_ARQ: the first retained packet marked for resending, with fresh
+ * headers */
+WritablePacket *
+TCPConnection::arq_resend()
+{ 
+	tcp_arqseg *s; 
+
+	for (s = _arq_head; s && ! s->resend; s = s->next) 
+		; 
+	if (! s) { 
+		_arq_resend = 0; 
+		return NULL; 
+	}
+	s->resend = false; 
+	_arq_resend--; 
+
+	Packet *c = s->p->clone(); 
+	WritablePacket *q = c ? c->uniqueify() : NULL; 
+	if (! q) 
+		return NULL; 
+	s->rxt++; 
+	s->sent = Timestamp::now(); 
+	speaker()->_tcpstat.tcps_arq_rexmt++; 
+	debug_output(VERB_TCP, "[%s] resending mesh packet [%u] try [%d]", SPKRNAME, s->seq, s->rxt); 
+	return stateless_encap(q, s->seq); 
+}
+
+
+/* MESH_ARQ: what the peer tells us about our packets. What it
+ * acknowledges is released, and measures the round trip unless it was
+ * resent. What it holds back is not resent on a timeout, and what it
+ * is missing below that is resent right away, unless it went out less
+ * than a round trip ago. */
+void
+TCPConnection::arq_ack_input(const click_mesharq &ma)
+{ 
+	Timestamp now = Timestamp::now(); 
+	tcp_arqseg *s; 
+
+	if (SEQ_GT(ma.ma_ack, _arq_una) && SEQ_LEQ(ma.ma_ack, _arq_nxt)) { 
+		int64_t rtt = -1; 
+		while ((s = _arq_head) && SEQ_LEQ(s->seq + s->p->length(), ma.ma_ack)) { 
+			rtt = s->rxt ? -1 : (now - s->sent).usecval(); 
+			if (s->resend) 
+				_arq_resend--; 
+			_arq_head = s->next; 
+			s->p->kill(); 
+			delete s; 
+		}
+		if (! _arq_head) 
+			_arq_tail = NULL; 
+		_arq_una = ma.ma_ack; 
+
+		if (rtt >= 0) { 
+			uint32_t r = rtt; 
+			if (! _arq_srtt_us) { 
+				_arq_srtt_us = r; 
+				_arq_rttvar_us = r / 2; 
+			} else { 
+				uint32_t d = r > _arq_srtt_us ? r - _arq_srtt_us : _arq_srtt_us - r; 
+				_arq_rttvar_us = (3 * _arq_rttvar_us + d) / 4; 
+				_arq_srtt_us = (7 * _arq_srtt_us + r) / 8; 
+			}
+			_arq_rto_us = max(min(_arq_srtt_us + 4 * _arq_rttvar_us, 
+				(uint32_t) MESH_ARQ_MAXRTO * 1000), (uint32_t) MESH_ARQ_MINRTO * 1000); 
+		}
+		/* the FIN waited for this */
+		if (! _arq_head && (tp->t_sl_flags & TH_FIN)) 
+			tp->t_sl_send = 1; 
+		if (has_pullable_data() || tp->t_sl_send) 
+			set_pullable(TCPS_STATELESS_OUTPUT, true); 
+	}
+
+	bool block = ma.ma_sack != ma.ma_sackend && 
+		SEQ_GEQ(ma.ma_sack, _arq_una) && SEQ_LEQ(ma.ma_sackend, _arq_nxt); 
+	bool nack = false; 
+	for (s = _arq_head; s; s = s->next) { 
+		/* only what the latest report holds back counts as held, the
+		 * peer may have dropped what it reported before */
+		if (block && SEQ_GEQ(s->seq, ma.ma_sack) && SEQ_LT(s->seq, ma.ma_sackend)) { 
+			s->sacked = true; 
+			continue; 
+		}
+		s->sacked = false; 
+		if (block && SEQ_LT(s->seq, ma.ma_sack) && ! s->resend && 
+			(now - s->sent).usecval() >= (int64_t) _arq_srtt_us) { 
+			s->resend = true; 
+			_arq_resend++; 
+			speaker()->_tcpstat.tcps_arq_nack++; 
+			nack = true; 
+		}
+	}
+	if (nack) 
+		set_pullable(TCPS_STATELESS_OUTPUT, true); 
+}
+
+
+/* MESH_ARQ: take a mesh packet of the peer's starting at <seq>. Old ones
+ * are duplicates and ones too far ahead don't fit the window, both are
+ * dropped; the rest goes through _arq_rq to be handed on in order. Gaps
+ * and duplicates are acknowledged right away, so the peer learns about
+ * them. */
+int
+TCPConnection::arq_input(WritablePacket *p, tcp_seq_t seq)
+{ 
+	unsigned len = p->length(); 
+	int retval = 0; 
+
+	if (SEQ_LT(seq, _arq_rcv_nxt)) { 
+		speaker()->_tcpstat.tcps_arq_dup++; 
+		p->kill(); 
+		_arq_ack_now = true; 
+	} else if (SEQ_GT(seq + len, _arq_rcv_nxt + speaker()->globals()->mesh_arq_window)) { 
+		speaker()->_tcpstat.tcps_arq_outwin++; 
+		p->kill(); 
+		_arq_ack_now = true; 
+		retval = -1; 
+	} else { 
+		if (seq != _arq_rcv_nxt) { 
+			speaker()->_tcpstat.tcps_arq_ooo++; 
+			_arq_ack_now = true; 
+		}
+		if (_arq_rq.push(p, seq, seq + len) < 0) { 
+			p->kill(); 
+			retval = -2; 
+		}
+		arq_deliver(); 
+		/* held back data went on with it, the peer waits to hear */
+		if (++_arq_unacked >= MESH_ARQ_DELACK || SEQ_GT(_arq_rcv_nxt, seq + len)) 
+			_arq_ack_now = true; 
+	}
+
+	if (_arq_ack_now) 
+		set_pullable(TCPS_STATELESS_OUTPUT, true); 
+	/* a delayed ack, or data held back for room in the send fifo */
+	if (! _arq_ack_now || ! _arq_rq.is_empty()) 
+		speaker()->arq_enqueue(this); 
+	return retval; 
+}
+
+
+/* MESH_ARQ: hand on what is in order, as far as the send fifo takes it,
+ * and note the first block still waiting. Returns whether anything was
+ * handed on. */
+bool
+TCPConnection::arq_deliver()
+{ 
+	bool any = false; 
+
+	while (! _arq_rq.is_empty() && _arq_rq.first() == _arq_rcv_nxt && 
+		_q_usr_input.pkt_length() < FIFO_SIZE - 1) { 
+		tcp_seq_t nxt = _arq_rq.first() + _arq_rq.first_len(); 
+		WritablePacket *q = _arq_rq.pull_front(); 
+		if (! q) 
+			break; 
+		_arq_rcv_nxt = nxt; 
+		any = true; 
+		/* what was trimmed away as a duplicate, or comes too late */
+		if (! q->length() || tp->t_state > TCPS_CLOSE_WAIT) 
+			q->kill(); 
+		else 
+			_q_usr_input.push(q); 
+	}
+
+	if (_arq_rq.is_empty()) { 
+		_arq_sack = _arq_sack_end = _arq_rcv_nxt; 
+	} else { 
+		_arq_rq.loop_last(); 
+		_arq_sack = _arq_rq.first(); 
+		_arq_sack_end = _arq_rq.last_nxt(); 
+	}
+	return any; 
+}
+
+
+/* MESH_ARQ: every MESH_ARQ_TICK while we are in the speaker's _arq_list.
+ * Marks what timed out for resending and backs off, or gives up on the
+ * connection once a packet was resent MESH_ARQ_MAXRXT times, hands on what
+ * waited for room in the send fifo and sends a delayed acknowledgement.
+ * Returns whether there is still something to time or hand on. */
+bool
+TCPConnection::arq_timeout(const Timestamp &now)
+{ 
+	bool expired = false; 
+	bool ack = _arq_unacked && ! _arq_ack_now; 
+
+	for (tcp_arqseg *s = _arq_head; s; s = s->next) { 
+		if (s->sacked || s->resend || 
+			(now - s->sent).usecval() < (int64_t) _arq_rto_us) 
+			continue; 
+		if (s->rxt >= MESH_ARQ_MAXRXT) { 
+			debug_output(VERB_TCP, "[%s] giving up on mesh packet [%u]", SPKRNAME, s->seq); 
+			speaker()->_tcpstat.tcps_arq_giveup++; 
+			arq_release(); 
+			tcp_drop(ETIMEDOUT); 
+			return false; 
+		}
+		s->resend = true; 
+		_arq_resend++; 
+		speaker()->_tcpstat.tcps_arq_timeout++; 
+		expired = true; 
+	}
+	if (expired) { 
+		_arq_rto_us = min(2 * _arq_rto_us, (uint32_t) MESH_ARQ_MAXRTO * 1000); 
+		set_pullable(TCPS_STATELESS_OUTPUT, true); 
+	}
+	/* the peer holds back what it thinks we have, it must hear once
+	 * _arq_rcv_nxt moves */
+	if (! _arq_rq.is_empty() && arq_deliver()) 
+		ack = true; 
+	if (ack) { 
+		_arq_ack_now = true; 
+		set_pullable(TCPS_STATELESS_OUTPUT, true); 
+	}
+	return _arq_head != NULL || ! _arq_rq.is_empty(); 
+}
+
+
+/* MESH_ARQ: forget all retained packets */
+void
+TCPConnection::arq_release()
+{ 
+	while (_arq_head) { 
+		tcp_arqseg *s = _arq_head; 
+		_arq_head = s->next; 
+		s->p->kill(); 
+		delete s; 
+	}
+	_arq_tail = NULL; 
+	_arq_resend = 0; 
+	_arq_una = _arq_nxt; 
+}
+
+
+
+/* Take a stateless packet from the mesh, and remove its ip and (either tcp or)
+ * udp headers. If the payload of the packet is 0 bytes, we have decapsulated a
+ * stateless signaling packet, and we should process the header accordingly. We
+ * return the length of the payload of the packet. Length 0 means that the
+ * packet has no payload, only stateless headers. The stateless flags are
+ * returned in sl_flags. With MESH_ARQ, has_arq is set if the packet
+ * carried sequence numbers, and ma holds them in host order.
+ */
+int
+TCPConnection::stateless_decap(WritablePacket *p, uint8_t *sl_flags, 
+	click_mesharq *ma, bool *has_arq) { 
+
+	unsigned int hlen = 0;
+	bool arq = speaker()->globals()->mesh_arq; 
+
+	/* Compact mesh header: the tag has already led us here. The peer
+	 * using it means it has learned our tag, so stop advertising. */
+	if (p->length() >= sizeof(click_meshhdr) && mesh_is_compact(p->data())) { 
+		uint8_t vf = p->data()[0]; 
+		hlen = mesh_hdrlen(vf); 
+		*sl_flags = reinterpret_cast<const click_meshhdr *>(p->data())->mh_flags; 
+		_mesh_adv = _mesh_adv_signal = false; 
+		if (arq && (vf & MESH_F_SEQ) && hlen <= p->length()) { 
+			memcpy(ma, p->data() + mesh_field_offset(vf, MESH_F_SEQ), sizeof(*ma)); 
+			*has_arq = true; 
+		}
+		goto payload; 
+	}
+
+	if (! p->network_header()) 
+	    return 0;
+
+	hlen += sizeof(click_ip);
+	
+	switch (p->ip_header()->ip_p) { 
+		case IP_PROTO_TCP: 
+			hlen += (p->tcp_header()->th_off << 2); 
+			*sl_flags = p->tcp_header()->th_flags; 
+			if (arq) { 
+				ma->ma_seq = p->tcp_header()->th_seq; 
+				ma->ma_ack = p->tcp_header()->th_ack; 
+				ma->ma_sack = ma->ma_sackend = 0; 
+				*has_arq = true; 
+			}
+			if (_mesh_rtag || arq) 
+				mesh_input_options(p->tcp_header(), arq ? ma : NULL); 
+			break; 
+		case IP_PROTO_UDP: 
+			hlen += sizeof(click_udp); 
+			break; 
+	}
+
+  payload: 
+	if (*has_arq) { 
+		ma->ma_seq = ntohl(ma->ma_seq); 
+		ma->ma_ack = ntohl(ma->ma_ack); 
+		ma->ma_sack = ntohl(ma->ma_sack); 
+		ma->ma_sackend = ntohl(ma->ma_sackend); 
+	}
+	/* Packet has payload */ 
+	if (hlen < p->length()) {
+	    p->pull(hlen); 
+	    return hlen; 
+	/* Payloadless signal packet */ 
+	} else if (hlen == p->length()) { 
+		debug_output(VERB_TCP, "[%s] tcpcon::st_decap recieved a payloadless tcp segment (probably a signal segment)", SPKRNAME);
+	    p->kill(); 
+		p = NULL;
+	    return 0; 
+	} else {
+		// EINVAL means Error Invalid. man errno :-)
+	    return -EINVAL; 
+	}
+}
+
+
+/* Recieves a stateless mesh packet, passess it to have its headers removed, and
+ * then if the packet has a payload, pushes it into the FIFO to be pushed to the
+ * stateful reciever, OR if any stateless flags were set, performs the
+ * appropriate action.
+ */
+int 
+TCPConnection::usrsend(WritablePacket *p)
+{ 
+    if (tp->so_flags & SO_FIN_AFTER_UDP_IDLE) {
+		debug_output(VERB_TIMERS, "[%s] tcpcon::usrsend setting timer TCPT_IDLE to [%d]", 
+			SPKRNAME, speaker()->globals()->so_idletime); 
+		tp->t_timer[TCPT_IDLE] = speaker()->globals()->so_idletime;  
+	}
+
+	// the stateless tcp flags field from the recieved stateless packet
+	uint8_t sl_flags = 0; 
+	click_mesharq ma; 
+	bool has_arq = false; 
+	int retval = 0 ; 
+	retval = stateless_decap(p, &sl_flags, &ma, &has_arq); 
+
+	// A problem occurred while removing the stateless packet header
+    if (retval < 0) {
+		debug_output(VERB_ERRORS, "[%s] TCPConnection::stateless_decap returned an error: [%d]", SPKRNAME, retval);
+		return retval; 
+	}
+
+	// Signals and their acknowledgements count in any state
+	uint8_t signals = stateless_signal_input(sl_flags); 
+	// So does what the far side got of our mesh packets
+	if (has_arq) 
+		arq_ack_input(ma); 
+ 
+	// If we were closed or listening, we will have to send a SYN, unless
+	// this connection has already been closed in either direction
+    if ((retval > 0 || (signals & TH_SYN)) && 
+		((tp->t_state == TCPS_CLOSED) || (tp->t_state == TCPS_LISTEN)) && 
+		! ((tp->t_sl_rcvd | tp->t_sl_raised) & (TH_FIN | TH_RST))) {
+		tcp_set_state(TCPS_SYN_SENT);
+	}
+
+	// MESH_ARQ: in order through the reordering queue, which also takes
+	// care of the sanity check below
+	if (retval > 0 && has_arq) { 
+		retval = arq_input(p, ma.ma_seq); 
+	// Sanity Check: We should never recieve data after our tcp state is
+	// beyond CLOSE_WAIT.
+	} else if (retval > 0 && tp->t_state > TCPS_CLOSE_WAIT) { 
+		p->kill(); 
+		retval = -3; 
+	// The packet was successfully decapsulated
+	} else if (retval > 0) {
+		retval = _q_usr_input.push(p); 
+	}
+
+	// The far side aborted: so do we
+	if (signals & TH_RST) { 
+		tcp_drop(ECONNRESET); 
+		return retval; 
+	}
+	// The far side is done sending, close once its data has been sent
+	if (signals & TH_FIN) { 
+		if (tp->t_state == TCPS_SYN_SENT) 
+			tp->t_flags |= TF_NEEDFIN; 
+		else 
+			usrclosed(); 
+	}
+
+	/* FASTOPEN: a signal that opened us carries no data, the SYN waits
+	 * for the first mesh packet that does, as in usropen() */
+	if (tp->t_state == TCPS_SYN_SENT && 
+		speaker()->globals()->fastopen && _q_usr_input.is_empty() && 
+		speaker()->tfo_cache_get(tcp_peer_addr())) 
+		return retval; 
+
+	//  These are the states where we expect to recieve packets
+	//	if ( (tp->t_state == TCPS_ESTABLISHED) || ( tp->t_state == TCPS_CLOSE_WAIT ))
+	tcp_output(); 
+    return retval;
+}
+
+/* user request 424*/
+void 
+TCPConnection::usrclosed() 
+{ 
+    if (! tp) 
+		return; 
+    switch (tp->t_state) { 
+		case TCPS_CLOSED:
+		case TCPS_LISTEN:
+		case TCPS_SYN_SENT:
+			tcp_set_state(TCPS_CLOSED);
+			break;
+		case TCPS_SYN_RECEIVED:
+		case TCPS_ESTABLISHED:
+			tcp_set_state(TCPS_FIN_WAIT_1);
+			break;
+		case TCPS_CLOSE_WAIT:
+			tcp_set_state(TCPS_LAST_ACK); 
+			break;
+    }
+    tcp_output();
+}
+
+
+void 
+TCPConnection::usropen() 
+{ 
+	if (! tp && ! tcp_attach()) 
+		return; 
+	if (tp->iss == 0) {
+		tp->iss = 0x11111111; 
+		debug_output(VERB_ERRORS, "Setting initial sequence to [%d], because it was 0", tp->iss);
+		// Setting a non-zero initial sequence number because I see some weird
+		// problems in wireshark when initial seq is 0
+	}
     debug_output(VERB_STATES,"[%s] usropen with state <%s>, initial seq num <%d> \n", 
     	dispatcher()->name().c_str(), tcpstates[tp->t_state], tp->iss); 
     if (tp->t_state == TCPS_CLOSED || tp->t_state == TCPS_LISTEN)
 		tcp_set_state(TCPS_SYN_SENT); 
+    /* FASTOPEN: with a cookie for the server the SYN waits for the mesh
+     * packet that opened us, usrsend() sends it along with its data */
+    if (speaker()->globals()->fastopen && _q_usr_input.is_empty() && 
+		speaker()->tfo_cache_get(tcp_peer_addr())) 
+		return; 
     tcp_output(); 
 }
 
@@ -1763,7 +2663,7 @@ TCPConnection::set_state(const MFHState new_state, const int input) {
 	if ((new_state == SHUTDOWN) && tcp_state() <= TCPS_ESTABLISHED) 
 	    usrclosed(); 
 
-	if (new_state == CLOSE) { 
+	if (new_state == CLOSE && tp) { 
 	    tcp_set_state(TCPS_CLOSED); 
 	    /* tcp_output(); */
 	} 
@@ -1773,29 +2673,17 @@ TCPConnection::set_state(const MFHState new_state, const int input) {
 
 
 void 
-TCPConnection::ip_output(WritablePacket *p) { 
+TCPConnection::ip_output(WritablePacket *p, uint32_t payload_sum) { 
 
+    /* the rest of the IP header comes from t_template */
     click_ip * iph = reinterpret_cast<click_ip *>(p->data());
 
-    iph->ip_v = 4;
-    iph->ip_hl = 5;
-    iph->ip_tos = 0x00; 
     iph->ip_len = htons(p->length());
     iph->ip_id = speaker()->get_and_increment_ip_id();
-    iph->ip_off = htons(IP_DF);
-    iph->ip_ttl = 255;
-    iph->ip_p = IP_PROTO_TCP;
-    iph->ip_sum = 0 ; 
 
-
-//    debug_output(VERB_DEBUG, "[%s] tcpcon::ip_output before srcip [%s]", SPKRNAME, flowid()->daddr().unparse().c_str()); 
-//    debug_output(VERB_DEBUG, "[%s] tcpcon::ip_output before dstip [%s]", SPKRNAME, flowid()->saddr().unparse().c_str()); 
-
-    iph->ip_src = flowid()->daddr(); 
-    iph->ip_dst = flowid()->saddr(); 
-
-//    debug_output(VERB_DEBUG, "[%s] tcpcon::ip_output after srcip [%s]", SPKRNAME, IPAddress(iph->ip_src).unparse().c_str()); 
-//    debug_output(VERB_DEBUG, "[%s] tcpcon::ip_output after dstip [%s]", SPKRNAME, IPAddress(iph->ip_dst).unparse().c_str()); 
+    /* super-segments are checksummed per segment by the segmenter */
+    if (speaker()->globals()->checksum && ! TCPS_GSO_ANNO(p)) 
+		tcp_ip_checksum(iph, p->length(), payload_sum); 
 
 
     p->set_dst_ip_anno(IPAddress(iph->ip_dst));
@@ -1804,7 +2692,96 @@ TCPConnection::ip_output(WritablePacket *p) {
         speaker()->output(1).push(p);
     */
 	print_tcpstats(p, "tcp_output");
-    output(1).push(p); 
+    if (speaker()->globals()->pacing) 
+		pace_output(p); 
+    else 
+		output(1).push(p); 
+}
+
+
+/* PACING: payload bytes of a segment tcp_output built */
+static inline unsigned
+pace_payload(const Packet *p) 
+{ 
+    const click_ip *iph = p->ip_header(); 
+    const click_tcp *th = reinterpret_cast<const click_tcp *>(iph + 1); 
+    return p->length() - sizeof(click_ip) - (th->th_off << 2); 
+}
+
+
+/* PACING: send the segment if its time has come and nothing is waiting
+ * before it, queue it for the speaker's pacing timer otherwise.
+ * Segments without data don't use up any of the rate. */
+void
+TCPConnection::pace_output(WritablePacket *p) 
+{ 
+    if (! _pace_head && (! pace_payload(p) || _pace_next <= Timestamp::now())) { 
+		pace_depart(p); 
+		output(TCPS_STATEFULL_OUTPUT).push(p); 
+		return; 
+    }
+    p->set_next(NULL); 
+    if (_pace_tail) 
+		_pace_tail->set_next(p); 
+    else 
+		_pace_head = p; 
+    _pace_tail = p; 
+    if (_pace_idx < 0) 
+		speaker()->pace_insert(this); 
+}
+
+
+/* PACING: <p> leaves now. It moves our next departure time on if it
+ * carries data, and starts the RTT clock if it is the timed segment. */
+void
+TCPConnection::pace_depart(Packet *p) 
+{ 
+    unsigned len = pace_payload(p); 
+
+    if (! len) 
+		return; 
+    pace_advance(p->length()); 
+    if (_pace_timing && ! _pace_rtt_start && 
+		ntohl(p->tcp_header()->th_seq) == _pace_rtseq) 
+		_pace_rtt_start = Timestamp::now(); 
+}
+
+
+/* PACING: move our next departure time on by the time <len> bytes take at
+ * our rate, the window per smoothed RTT times a gain of 2 in slow start
+ * and 1.25 afterwards */
+void
+TCPConnection::pace_advance(unsigned len) 
+{ 
+    Timestamp now = Timestamp::now(); 
+    u_long w = min(tp->snd_cwnd, tp->snd_wnd); 
+    unsigned gain4 = tp->snd_cwnd < tp->snd_ssthresh ? 8 : 5; 
+    uint64_t usec; 
+
+    if (! _pace_srtt_us) 
+		return; 
+    if (w < tp->t_maxseg) 
+		w = tp->t_maxseg; 
+    usec = (uint64_t) len * _pace_srtt_us * 4 / (gain4 * w); 
+    if (_pace_next < now) 
+		_pace_next = now; 
+    _pace_next += Timestamp::make_usec(usec / 1000000, usec % 1000000); 
+}
+
+
+/* PACING: an RTT sample in microseconds, once the timed segment has been
+ * acknowledged */
+void
+TCPConnection::pace_rtt(tcp_seq_t ack) 
+{ 
+    uint32_t usec; 
+
+    if (! _pace_rtt_start || SEQ_LEQ(ack, _pace_rtseq)) 
+		return; 
+    usec = (Timestamp::now() - _pace_rtt_start).usecval(); 
+    _pace_srtt_us = _pace_srtt_us ? (_pace_srtt_us * 7 + usec) / 8 : usec; 
+    _pace_rtt_start = Timestamp(); 
+    _pace_timing = false; 
 }
 
 
@@ -1813,9 +2790,17 @@ TCPConnection::_tcp_dooptions(u_char *cp, int cnt, const click_tcp * ti,
 	int * ts_present, u_long *ts_val, u_long *ts_ecr) 
 { 
 	uint16_t mss;
+	uint32_t ts;
 	int opt, optlen; 
 	optlen = 0; 
 
+	/* the common case: just a timestamp, in the recommended layout */
+	if (! (ti->th_flags & TH_SYN) && 
+		tcp_predict_timestamp(cp, cnt, ts_val, ts_ecr)) { 
+		*ts_present = 1; 
+		return; 
+	}
+
 	debug_output(VERB_DEBUG, "[%s] tcp_dooption cnt [%u]\n", SPKRNAME, cnt);
 	for (; cnt > 0; cnt -= optlen, cp += optlen) { 
 
@@ -1872,10 +2857,10 @@ TCPConnection::_tcp_dooptions(u_char *cp, int cnt, const click_tcp * ti,
 				if (optlen != TCPOLEN_TIMESTAMP)
 					continue;
 				*ts_present = 1; 
-				bcopy((char *)cp + 2, (char *)ts_val, sizeof(*ts_val)); //FIXME: Misaligned
-				*ts_val = ntohl(*ts_val); 
-				bcopy((char *)cp + 6, (char *)ts_ecr, sizeof(*ts_ecr)); //FIXME: Misaligned
-				*ts_ecr = ntohl(*ts_ecr); 
+				memcpy(&ts, cp + 2, sizeof(ts)); 
+				*ts_val = ntohl(ts); 
+				memcpy(&ts, cp + 6, sizeof(ts)); 
+				*ts_ecr = ntohl(ts); 
 
 				debug_output(VERB_DEBUG, "[%s] doopts: ts_val [%u] ts_ecr [%u]", SPKRNAME, *ts_val, *ts_ecr);
 				if (ti->th_flags & TH_SYN) { 
@@ -1919,6 +2904,34 @@ TCPConnection::_tcp_dooptions(u_char *cp, int cnt, const click_tcp * ti,
 				debug_output(VERB_DEBUG, "[%s] WSCALE set, flags [%x], req_s_sc [%x]\n", SPKRNAME,
 						tp->t_flags, tp->requested_s_scale );
 				break;
+			case TCPOPT_FASTOPEN:
+				if (! speaker()->globals()->fastopen || !(ti->th_flags & TH_SYN)) 
+					continue;
+				if (optlen != TCPOLEN_FASTOPEN_REQ && 
+					(optlen < TCPOLEN_FASTOPEN_REQ + TCP_FASTOPEN_MINCOOKIE || 
+					 optlen > TCPOLEN_FASTOPEN_REQ + TCP_FASTOPEN_MAXCOOKIE || 
+					 (optlen & 1))) 
+					continue;
+				/* a server's cookie in its SYN-ACK, for our next SYN */
+				if (ti->th_flags & TH_ACK) { 
+					if (optlen > TCPOLEN_FASTOPEN_REQ) 
+						speaker()->tfo_cache_set(tcp_peer_addr(), cp + 2, 
+							optlen - TCPOLEN_FASTOPEN_REQ); 
+					break;
+				}
+				/* a client's SYN: take its data if the cookie is valid,
+				 * hand out one that is otherwise */
+				if (speaker()->tfo_cookie_valid(tcp_peer_addr(), cp + 2, 
+					optlen - TCPOLEN_FASTOPEN_REQ)) { 
+					tp->t_flags |= TF_FASTOPEN; 
+				} else { 
+					if (optlen > TCPOLEN_FASTOPEN_REQ) 
+						speaker()->_tcpstat.tcps_tfo_badcookie++; 
+					tp->t_flags |= TF_TFO_COOKIE; 
+				}
+				debug_output(VERB_DEBUG, "[%s] doopts: FASTOPEN len [%u] flags [%x]", SPKRNAME, 
+						optlen, tp->t_flags);
+				break;
 			default: 
 			continue; 
 		}
@@ -1927,16 +2940,133 @@ TCPConnection::_tcp_dooptions(u_char *cp, int cnt, const click_tcp * ti,
 }
 
 
-void
-TCPConnection::print_state(StringAccum &sa) 
+/* The address of our TCP peer, the server of an active and the client of
+ * a passive connection */
+uint32_t
+TCPConnection::tcp_peer_addr() const
 { 
-	int i;
-	sa << tcpstates[tp->t_state] << "\n"; 
-	
-	sa.snprintf(80, "| Seq    : snd_nxt: %u, snd_una: %u, (in-flight: %u)\n", 
-		tp->snd_nxt, tp->snd_una, tp->snd_nxt - tp->snd_una); 
-	sa.snprintf(80, "| Windows: rcv_adv: %u, rcv_wnd: %u, snd_cwnd: %u \n",
-		tp->rcv_adv, tp->rcv_wnd, tp->snd_cwnd); 
+	return reinterpret_cast<const click_ip *>(tp->t_template)->ip_dst.s_addr; 
+}
+
+
+/* FASTOPEN options of a SYN: a cookie in the SYN-ACK if the client asked
+ * for one, and in our own SYN the server's cached cookie, or a request for
+ * one if there is none. With a cookie the SYN also carries the data
+ * waiting in the send buffer, except when it is retransmitted. Returns the
+ * option bytes, padded to whole words. */
+unsigned
+TCPConnection::tcp_fastopen_output(int flags, u_char *opt, long &len)
+{ 
+	const tcp_fastopen_cookie *c; 
+	unsigned n, pad; 
+
+	if (flags & TH_ACK) { 
+		if (! (tp->t_flags & TF_TFO_COOKIE)) 
+			return 0; 
+		opt[0] = opt[1] = TCPOPT_NOP; 
+		opt[2] = TCPOPT_FASTOPEN; 
+		opt[3] = TCPOLEN_FASTOPEN_REQ + TCP_FASTOPEN_COOKIELEN; 
+		speaker()->tfo_cookie(tcp_peer_addr(), opt + 4); 
+		speaker()->_tcpstat.tcps_tfo_cookiesent++; 
+		return 4 + TCP_FASTOPEN_COOKIELEN; 
+	}
+
+	c = speaker()->tfo_cache_get(tcp_peer_addr()); 
+	n = TCPOLEN_FASTOPEN_REQ + (c ? c->len : 0); 
+	pad = (4 - (n & 3)) & 3; 
+	memset(opt, TCPOPT_NOP, pad); 
+	opt[pad] = TCPOPT_FASTOPEN; 
+	opt[pad + 1] = n; 
+	if (c) { 
+		memcpy(opt + pad + 2, c->cookie, c->len); 
+		if (tp->t_rxtshift == 0 && ! _q_usr_input.is_empty()) { 
+			len = _q_usr_input.byte_length(); 
+			tp->t_flags |= TF_TFO_SYNDATA; 
+			speaker()->_tcpstat.tcps_tfo_syndata++; 
+		}
+	}
+	return pad + n; 
+}
+
+
+/* Specialized option handling, see TCPConnection::OptProfile */
+const TCPConnection::OptProfile TCPConnection::opt_profiles[2][2] = { 
+	{ { &TCPConnection::tcp_output_options<false>, 
+	    &TCPConnection::tcp_input_options<false, false> }, 
+	  { &TCPConnection::tcp_output_options<false>, 
+	    &TCPConnection::tcp_input_options<false, true> } }, 
+	{ { &TCPConnection::tcp_output_options<true>, 
+	    &TCPConnection::tcp_input_options<true, false> }, 
+	  { &TCPConnection::tcp_output_options<true>, 
+	    &TCPConnection::tcp_input_options<true, true> } } 
+}; 
+
+
+/* Called when the connection becomes ESTABLISHED, the options negotiated
+ * in the handshake don't change after that */
+void
+TCPConnection::tcp_select_opt_profile() 
+{ 
+	bool ts = (tp->t_flags & (TF_REQ_TSTMP | TF_RCVD_TSTMP | TF_NOOPT)) == 
+		(TF_REQ_TSTMP | TF_RCVD_TSTMP); 
+	bool ws = (tp->t_flags & (TF_REQ_SCALE | TF_RCVD_SCALE)) == 
+		(TF_REQ_SCALE | TF_RCVD_SCALE); 
+	_opt_profile = &opt_profiles[ts][ws]; 
+	debug_output(VERB_TCP, "[%s] option profile: timestamps [%d] scaling [%d]", SPKRNAME, ts, ws); 
+}
+
+
+/* Options of a segment that is not a SYN: a timestamp or nothing at all */
+template <bool TS> 
+unsigned
+TCPConnection::tcp_output_options(u_char *opt) 
+{ 
+	if (! TS) 
+		return 0; 
+	uint32_t ts[3]; 
+	ts[0] = htonl(TCPOPT_TSTAMP_HDR); 
+	ts[1] = htonl(speaker()->tcp_now()); 
+	ts[2] = htonl(tp->ts_recent); 
+	memcpy(opt, ts, sizeof(ts)); 
+	return TCPOLEN_TSTAMP_APPA; 
+}
+
+
+/* Parse the options of a non-SYN segment that follows the profile exactly
+ * (RFC 1323 appendix A layout for timestamps) and scale its window. Returns
+ * false for anything else, which then goes through _tcp_dooptions. */
+template <bool TS, bool WS> 
+bool
+TCPConnection::tcp_input_options(const u_char *optp, unsigned optlen, 
+	unsigned ti_win, unsigned &tiwin, 
+	int &ts_present, u_long &ts_val, u_long &ts_ecr) 
+{ 
+	if (TS) { 
+		if (! tcp_predict_timestamp(optp, optlen, &ts_val, &ts_ecr)) 
+			return false; 
+		ts_present = 1; 
+	} else if (optlen) { 
+		return false; 
+	}
+	tiwin = WS ? ti_win << tp->snd_scale : ti_win; 
+	return true; 
+}
+
+
+void
+TCPConnection::print_state(StringAccum &sa) 
+{ 
+	int i;
+	if (! tp) { 
+		sa << tcpstates[TCPS_CLOSED] << " (unattached)\n"; 
+		return; 
+	}
+	sa << tcpstates[tp->t_state] << "\n"; 
+	
+	sa.snprintf(80, "| Seq    : snd_nxt: %u, snd_una: %u, (in-flight: %u)\n", 
+		tp->snd_nxt, tp->snd_una, tp->snd_nxt - tp->snd_una); 
+	sa.snprintf(80, "| Windows: rcv_adv: %u, rcv_wnd: %u, snd_cwnd: %u \n",
+		tp->rcv_adv, tp->rcv_wnd, tp->snd_cwnd); 
 	sa.snprintf(80, "| Timing: t_srtt: %u, t_rttvar: %u, now: %u\n",
 		tp->t_srtt, tp->t_rttvar, speaker()->tcp_now()); 
 
@@ -1953,10 +3083,11 @@ TCPConnection::tcp_newtcpcb()
 	tcpcb *tp = new tcpcb();
 	if (tp == NULL)
 	    return NULL; 
+	speaker()->_mem.tcpcbs++; 
 	
 	bzero((char*)tp, sizeof(tcpcb)); 
 	tp->t_maxseg = speaker()->globals()->tcp_mssdflt; 
-	tp->t_flags  = TF_REQ_SCALE | TF_REQ_TSTMP; 
+	tp->t_flags  = 0; 
 	tp->t_srtt   = TCPTV_SRTTBASE; 
 	tp->t_rttvar = speaker()->globals()->tcp_rttdflt * PR_SLOWHZ << 2;
 	tp->t_rttmin = TCPTV_MIN; 
@@ -1972,27 +3103,49 @@ TCPConnection::tcp_newtcpcb()
 	tp->ip_out_hdr_len = sizeof(click_ip);
 	tp->so_flags = speaker()->globals()->so_flags; 
 	if (speaker()->globals()->window_scale) { 
-		tp->t_flags &= TF_REQ_SCALE; 
+		tp->t_flags |= TF_REQ_SCALE; 
 		tp->request_r_scale = speaker()->globals()->window_scale; 
 	} 
 	if (speaker()->globals()->use_timestamp) { 
-		tp->t_flags &= TF_REQ_TSTMP; 
+		tp->t_flags |= TF_REQ_TSTMP; 
 	}
 	return tp; 
 }
 
 
 TCPConnection::TCPConnection(TCPSpeaker *s, const IPFlowID &id, const char dir)
-	: MultiFlowHandler(s,id,dir), _q_recv(this), _q_usr_input(this)
+	: TypedMultiFlowHandler<TCPSpeaker>(s,id,dir), _arq_rq(this), _q_usr_input(this), _q_recv(this)
 {
 
-    tp = tcp_newtcpcb();  
-    tp->t_state = TCPS_CLOSED;
-    _errh = speaker()->error_handler();
+    tp = NULL; 
+    _opt_profile = NULL; 
+    _speaker_queue.next = _speaker_queue.prev = NULL; 
+    _speaker_queue.qid = SPEAKER_Q_NONE; 
+    _gro = NULL; 
+    _gro_segs = 0; 
+    _gro_next = NULL; 
+    _mesh_next = NULL; 
+    _mesh_waiting = _mesh_flush = false; 
+    _mesh_stag = 0; 
+    _mesh_stag_ok = _mesh_adv_signal = false; 
+    _mesh_rtag = s->globals()->mesh_compact ? s->mesh_tag_alloc(this) : 0; 
+    _mesh_adv = _mesh_rtag != 0; 
+    _pace_head = _pace_tail = NULL; 
+    _pace_idx = -1; 
+    _pace_srtt_us = 0; 
+    _pace_rtseq = 0; 
+    _pace_timing = false; 
+    _arq_head = _arq_tail = NULL; 
+    _arq_una = _arq_nxt = _arq_rcv_nxt = 0; 
+    _arq_sack = _arq_sack_end = 0; 
+    _arq_resend = _arq_unacked = 0; 
+    _arq_srtt_us = _arq_rttvar_us = 0; 
+    _arq_rto_us = MESH_ARQ_INITRTO * 1000; 
+    _arq_ack_now = _arq_listed = false; 
+    _arq_next = NULL; 
 
     so_recv_buffer_size = speaker()->globals()->so_recv_buffer_size; 
-    
-    _so_state = 0; 
+    _created = Timestamp::now(); 
 
     if (OUTGOING == dir) 
 	usropen(); 
@@ -2007,99 +3160,1115 @@ TCPConnection::TCPConnection(TCPSpeaker *s, const IPFlowID &id, const char dir)
     tp->timewait_timer = new Timer(TCPSpeaker::_tcp_timer_wait, this); 
     tp->timewait_timer->initialize(speaker()); 
     */
-    if (dispatcher()->dispatch_code(true, 1) == 
-	    (MFD_DISPATCH_MFD_DIRECT | MFD_DISPATCH_PULL)) { 
-		debug_output(VERB_DISPATCH, "[%s].<%x> Creating _stateless_pull task", 
-			dispatcher()->name().c_str(), this); 
-		_stateless_pull = new Task(&pull_stateless_input, this); 
-		_stateless_pull->initialize(dispatcher()->router(), true); 
+
+    StringAccum sa;
+    if (debug_enabled(VERB_STATES)) 
+	sa << *(flowid()); 
+    debug_output(VERB_STATES, "[%s] new connection %s %s", SPKRNAME, sa.c_str(), tcpstates[state()]); 
+}
+
+
+TCPConnection::~TCPConnection() 
+{
+    debug_output(VERB_MFD_QUEUES, 
+    "***** DELETING TCPConnection at <%x> ***** \n",
+    this); 
+    speaker()->pull_ready_dequeue(this, SPEAKER_Q_NONE); 
+    if (_gro) { 
+	speaker()->gro_dequeue(this); 
+	_gro->kill(); 
+    }
+    if (_mesh_waiting) 
+	speaker()->mesh_wait_dequeue(this); 
+    if (_mesh_rtag) 
+	speaker()->_mesh_tags.erase(_mesh_rtag); 
+    if (_pace_idx >= 0) 
+	speaker()->pace_remove(this); 
+    while (_pace_head) { 
+	Packet *p = _pace_head; 
+	_pace_head = p->next(); 
+	p->kill(); 
+    }
+    if (_arq_listed) 
+	speaker()->arq_dequeue(this); 
+    arq_release(); 
+    if (tp) { 
+	delete tp; 
+	speaker()->_mem.tcpcbs--; 
+    }
+}
+
+
+/* Allocate the control block on the first segment or open request */
+bool
+TCPConnection::tcp_attach() 
+{ 
+    tp = tcp_newtcpcb(); 
+    if (! tp) 
+	return false; 
+    tp->t_state = TCPS_CLOSED; 
+    tcp_template(); 
+    if (speaker()->globals()->hostcache) 
+	tcp_hc_seed(); 
+    return true; 
+}
+
+
+/* HOSTCACHE: start from what earlier connections to our peer learned */
+void
+TCPConnection::tcp_hc_seed() 
+{ 
+    tcp_hostcache *hc = speaker()->hostcache_get(tcp_peer_addr(), false); 
+
+    if (! hc) 
+	return; 
+    if (hc->srtt) { 
+	tp->t_srtt = hc->srtt; 
+	tp->t_rttvar = hc->rttvar; 
+	TCPT_RANGESET(tp->t_rxtcur, TCP_REXMTVAL(tp), 
+		tp->t_rttmin, TCPTV_REXMTMAX); 
+    }
+    if (hc->ssthresh) 
+	tp->snd_ssthresh = max(hc->ssthresh, 2 * (u_long) hc->mss); 
+    tp->t_hc_mss = hc->mss; 
+    tp->t_hc_cwnd = min(hc->cwnd, hc->ssthresh ? hc->ssthresh : 
+	TCP_HC_MAXIW * (u_long) hc->mss); 
+    hc->hits++; 
+    speaker()->_tcpstat.tcps_hc_hits++; 
+}
+
+
+/* HOSTCACHE: hand what this connection learned on to the next one, if it
+ * measured enough to be trusted, averaged with what is cached already */
+void
+TCPConnection::tcp_hc_update() 
+{ 
+    tcp_hostcache *hc; 
+    u_long ssthresh; 
+
+    if (tp->t_rttupdated < TCP_HC_MINSAMPLES) 
+	return; 
+    hc = speaker()->hostcache_get(tcp_peer_addr(), true); 
+    ssthresh = tp->snd_ssthresh < (u_long) TCP_MAXWIN << TCP_MAX_WINSHIFT ? 
+	tp->snd_ssthresh : 0; 
+    if (hc->updates) { 
+	hc->srtt = (hc->srtt + tp->t_srtt) / 2; 
+	hc->rttvar = (hc->rttvar + tp->t_rttvar) / 2; 
+	if (ssthresh) 
+	    hc->ssthresh = hc->ssthresh ? (hc->ssthresh + ssthresh) / 2 : ssthresh; 
+	hc->cwnd = (hc->cwnd + tp->snd_cwnd) / 2; 
+    } else { 
+	hc->srtt = tp->t_srtt; 
+	hc->rttvar = tp->t_rttvar; 
+	hc->ssthresh = ssthresh; 
+	hc->cwnd = tp->snd_cwnd; 
+    }
+    hc->mss = tp->t_maxseg; 
+    hc->updates++; 
+    speaker()->_tcpstat.tcps_hc_updates++; 
+}
+
+
+/* Prebuild the headers of our stateful segments (t_template). Segments
+ * start as a copy of it and only get their lengths, ids, sequence numbers,
+ * window and flags patched in. The template array is aligned, unlike the
+ * addresses in flowid(), which avoids the alignment traps on ARM the old
+ * per-segment assignments ran into. */
+void
+TCPConnection::tcp_template() 
+{ 
+    click_ip *iph = reinterpret_cast<click_ip *>(tp->t_template); 
+    click_tcp *th = reinterpret_cast<click_tcp *>(iph + 1); 
+
+    memset(tp->t_template, 0, sizeof(tp->t_template)); 
+    iph->ip_v = 4;
+    iph->ip_hl = sizeof(click_ip) >> 2;
+    iph->ip_off = htons(IP_DF);
+    iph->ip_ttl = 255;
+    iph->ip_p = IP_PROTO_TCP;
+    iph->ip_src = flowid()->daddr(); 
+    iph->ip_dst = flowid()->saddr(); 
+    th->th_sport = flowid()->dport(); 
+    th->th_dport = flowid()->sport(); 
+    th->th_off = sizeof(click_tcp) >> 2;
+}
+
+
+//Return the number of TCPConnections in the HandlerQueue of this TCPSpeaker
+String
+TCPSpeaker::read_num_connections(Element *e, void *)
+{
+  	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	int buckets = tcps->num_connections();
+	return String(buckets);
+}
+
+
+// Iterate over all TCPConnections and pass the packet pointer to each
+// connection, have that connection write its _q_recv value at that address, and
+// then return how many bytes it wrote or -1 if unable to write anymore.
+// Return the number of bytes written or -1 if one of the connections returned
+// -1
+int
+TCPSpeaker::iter_connections(void *address, int remainingbytes)
+{
+	int result = 0;
+	for (MFHIterator mfhs = all_handlers_iterator(); mfhs; ++mfhs) {
+		const char *key = mfhs.key().unparse().c_str();
+		const int val = handler(mfhs)->so_recv_buffer_space();
+		click_chatter("[%s] -> [%d]", key, val);
+	}
+
+	if (address || remainingbytes) {};
+
+	// Iterate over mfd_hash and obtain the following for each TCPConnection
+	// write the following into the string:
+	// 32bits srcaddr
+	// 32bits dstaddr
+	// 16bits srcport
+	// 16bits dstport 
+	// 32bits TCPConnection::so_recv_buffer_space()
+//	result.append("ffffffff", 8);
+//	click_chatter("printing [%s]", result.c_str());
+	return result;
+}
+
+
+/* Segments with a bad checksum are dropped before they can create or touch
+ * any connection state */
+void
+TCPSpeaker::push(int port, Packet *p)
+{
+    if (port == TCPS_STATEFULL_INPUT && _tcp_globals.checksum && 
+		! tcp_input_checksum_ok(p)) { 
+		_tcpstat.tcps_rcvbadsum++; 
+		debug_output(VERB_PACKETS, "[%s] dropping segment with bad checksum", name().c_str()); 
+		p->kill(); 
+		return; 
+    }
+    if (port == TCPS_STATELESS_INPUT && _tcp_globals.mesh_fec && 
+		p->length() >= sizeof(click_meshfec) && mesh_is_fec(p->data())) { 
+		fec_input(p); 
+		return; 
+    }
+    if (port == TCPS_STATELESS_INPUT) { 
+		mesh_push(p); 
+		return; 
+    }
+    MultiFlowDispatcher::push(port, p); 
+}
+
+
+/* A mesh packet, in either format. Compact ones carry no flow, only the
+ * receiver's tag. */
+void
+TCPSpeaker::mesh_push(Packet *p)
+{
+    if (_tcp_globals.mesh_compact && p->length() >= sizeof(click_meshhdr) && 
+		mesh_is_compact(p->data())) { 
+		if (p->data()[0] & MESH_F_AGG) 
+			mesh_agg_demux(p); 
+		else 
+			mesh_compact_push(p); 
+		return; 
+    }
+    MultiFlowDispatcher::push(TCPS_STATELESS_INPUT, p); 
+}
+
+
+/* Hand a compact mesh packet to the connection its tag belongs to. With
+ * MESH_CC, the hop fields are the speaker's; a zero tag carries only
+ * them. */
+void
+TCPSpeaker::mesh_compact_push(Packet *p)
+{
+    const click_meshhdr *mh = reinterpret_cast<const click_meshhdr *>(p->data()); 
+    TCPConnection *con; 
+
+    if ((mh->mh_vf & MESH_F_HOP) && p->length() >= mesh_hdrlen(mh->mh_vf)) { 
+		if (_tcp_globals.mesh_cc) 
+			mesh_hop_input(reinterpret_cast<const click_meshhop *>( 
+				p->data() + mesh_field_offset(mh->mh_vf, MESH_F_HOP))); 
+		if (! mh->mh_tag) { 
+			p->kill(); 
+			return; 
+		}
+    }
+    con = _mesh_tags.get(ntohs(mh->mh_tag)); 
+    if (! con) { 
+		debug_output(VERB_PACKETS, "[%s] dropping mesh packet with unknown tag [%u]", 
+			name().c_str(), ntohs(mh->mh_tag)); 
+		p->kill(); 
+		return; 
+    }
+    con->push(TCPS_STATELESS_INPUT, p); 
+}
+
+
+/* MESH_AGG: split an aggregate frame into its chunks. A malformed chunk
+ * ends the frame, the chunks before it are still delivered. */
+void
+TCPSpeaker::mesh_agg_demux(Packet *p)
+{
+    const click_meshhdr *mh = reinterpret_cast<const click_meshhdr *>(p->data()); 
+    const unsigned char *data = p->data() + sizeof(click_meshhdr); 
+    const unsigned char *end = p->end_data(); 
+
+    _tcpstat.tcps_rcvmeshagg++; 
+    for (int n = mh->mh_flags; n > 0 && end - data >= MESH_AGG_CHUNKLEN; n--) { 
+		unsigned len = (data[0] << 8) | data[1]; 
+		data += MESH_AGG_CHUNKLEN; 
+		if (len < sizeof(click_meshhdr) || len > (unsigned) (end - data) || 
+			! mesh_is_compact(data) || (data[0] & MESH_F_AGG)) { 
+			debug_output(VERB_ERRORS, "[%s] malformed chunk in aggregate mesh frame", name().c_str()); 
+			break; 
+		}
+		WritablePacket *q = Packet::make(Packet::default_headroom, data, len, 0); 
+		data += len; 
+		if (! q) 
+			break; 
+		q->copy_annotations(p); 
+		q->set_network_header(q->data(), 0); 
+		mesh_compact_push(q); 
+    }
+    p->kill(); 
+}
+
+
+/* MESH_AGG, MESH_CC and MESH_FEC: only the stateless output is
+ * aggregated, held back while the hop's rate is used up, and protected by
+ * repair packets. A repair packet leaves right after its block. */
+Packet *
+TCPSpeaker::pull(int port)
+{
+    Packet *p; 
+
+    if (port != TCPS_STATELESS_OUTPUT) 
+		return MultiFlowDispatcher::pull(port); 
+    if (_tcp_globals.mesh_cc && ! mesh_cc_admit()) 
+		return NULL; 
+    if ((p = _fec_repair)) 
+		_fec_repair = NULL; 
+    else { 
+		p = _tcp_globals.mesh_agg ? mesh_agg_pull() : MultiFlowDispatcher::pull(port); 
+		if (_tcp_globals.mesh_cc) { 
+			if (p) 
+				_meshcc.dst = p->dst_ip_anno(); 
+			else 
+				p = mesh_cc_feedback(); 
+		}
+		if (_tcp_globals.mesh_fec) 
+			p = fec_output(p); 
+    }
+    if (_tcp_globals.mesh_cc && p) 
+		_meshcc.tokens -= p->length(); 
+    return p; 
+}
+
+
+/* MESH_FEC: put <p> into the current block, and finish the block once it
+ * is full. Without a packet, a partial block is finished after
+ * MESH_FEC_DELAY; _fec_timer wakes the puller up for it. */
+Packet *
+TCPSpeaker::fec_output(Packet *p)
+{
+    tcp_meshfec &f = _fec; 
+    Timestamp now = Timestamp::now(); 
+
+    if (! p) { 
+		if (! f.snd_count) 
+			return NULL; 
+		Timestamp due = f.snd_start + Timestamp::make_msec(MESH_FEC_DELAY); 
+		if (now < due) { 
+			if (! _fec_timer->scheduled()) 
+				_fec_timer->schedule_at(due); 
+			return NULL; 
+		}
+		fec_finish_block(); 
+		p = _fec_repair; 
+		_fec_repair = NULL; 
+		return p; 
+    }
+
+    unsigned len = p->length(); 
+    WritablePacket *q = p->push(sizeof(click_meshfec)); 
+    if (! q) 
+		return NULL; 
+    click_meshfec *mf = reinterpret_cast<click_meshfec *>(q->data()); 
+    mf->mf_vf = MESH_FEC_VERSION << 4; 
+    mf->mf_block = htons(f.snd_block); 
+    mf->mf_loss = f.rcv_loss; 
+    mf->mf_pad = 0; 
+    mf->mf_len = 0; 
+    q->set_network_header(q->data(), 0); 
+    if (len > MESH_FEC_MAXLEN) { 
+		mf->mf_index = MESH_FEC_NOBLOCK; 
+		return q; 
+    }
+
+    if (! f.snd_count) 
+		f.snd_start = now; 
+    mf->mf_index = f.snd_count++; 
+    const unsigned char *data = q->data() + sizeof(click_meshfec); 
+    for (unsigned i = 0; i < len; i++) 
+		f.snd_acc[i] ^= data[i]; 
+    if (len > f.snd_acclen) 
+		f.snd_acclen = len; 
+    f.snd_lenxor ^= len; 
+    f.dst = q->dst_ip_anno(); 
+    if (f.snd_count >= f.snd_k) { 
+		fec_finish_block(); 
+		empty_note(TCPS_STATELESS_OUTPUT)->wake(); 
+    }
+    return q; 
+}
+
+
+/* MESH_FEC: make the current block's repair packet and start the next
+ * block, sized to the loss the peer reports so that half a packet per
+ * block is expected lost. One repair packet rebuilds only one loss, so
+ * most blocks have to lose at most that. */
+void
+TCPSpeaker::fec_finish_block()
+{
+    tcp_meshfec &f = _fec; 
+    WritablePacket *r = Packet::make(Packet::default_headroom, 0, 
+		sizeof(click_meshfec) + f.snd_acclen, 0); 
+
+    if (r) { 
+		click_meshfec *mf = reinterpret_cast<click_meshfec *>(r->data()); 
+		mf->mf_vf = (MESH_FEC_VERSION << 4) | MESH_FEC_REPAIR; 
+		mf->mf_index = f.snd_count; 
+		mf->mf_block = htons(f.snd_block); 
+		mf->mf_loss = f.rcv_loss; 
+		mf->mf_pad = 0; 
+		mf->mf_len = htons(f.snd_lenxor); 
+		memcpy(mf + 1, f.snd_acc, f.snd_acclen); 
+		r->set_network_header(r->data(), 0); 
+		r->set_dst_ip_anno(f.dst); 
+		if (_fec_repair) 
+			_fec_repair->kill(); 
+		_fec_repair = r; 
+		_tcpstat.tcps_fec_repairs++; 
+    }
+    memset(f.snd_acc, 0, f.snd_acclen); 
+    f.snd_acclen = 0; 
+    f.snd_lenxor = 0; 
+    f.snd_count = 0; 
+    f.snd_block++; 
+    f.snd_k = f.peer_loss ? 128 / f.peer_loss : _tcp_globals.mesh_fec_block; 
+    if (f.snd_k < MESH_FEC_MINBLOCK) 
+		f.snd_k = MESH_FEC_MINBLOCK; 
+    if (f.snd_k > (int) _tcp_globals.mesh_fec_block) 
+		f.snd_k = _tcp_globals.mesh_fec_block; 
+    _fec_timer->unschedule(); 
+}
+
+
+/* MESH_FEC: the receive slot of <block>, reused for it if it held an
+ * older one. NULL if <block> is older than what the slot holds. */
+tcp_fecblock *
+TCPSpeaker::fec_block(uint16_t block)
+{
+    tcp_fecblock *b = &_fec.rcv[block % MESH_FEC_RCVBLOCKS]; 
+
+    if (b->used && b->block == block) 
+		return b; 
+    if (b->used && (int16_t) (block - b->block) < 0) 
+		return NULL; 
+    b->used = true; 
+    b->block = block; 
+    b->done = false; 
+    b->mask = 0; 
+    b->count = 0; 
+    b->lenxor = 0; 
+    memset(b->acc, 0, sizeof(b->acc)); 
+    return b; 
+}
+
+
+/* MESH_FEC: a packet of a block is XORed into the block's slot and handed
+ * on. The repair packet tells how many the block had; with exactly one
+ * missing, the repair packet XOR the slot is that one. Packets of blocks
+ * too old for the slots are handed on unchecked. */
+void
+TCPSpeaker::fec_input(Packet *p)
+{
+    const click_meshfec *mf = reinterpret_cast<const click_meshfec *>(p->data()); 
+    unsigned len = p->length() - sizeof(click_meshfec); 
+    bool repair = mf->mf_vf & MESH_FEC_REPAIR; 
+    int index = mf->mf_index; 
+    uint16_t lenxor = ntohs(mf->mf_len); 
+    tcp_fecblock *b; 
+
+    _fec.peer_loss = mf->mf_loss; 
+    if (! repair && index == MESH_FEC_NOBLOCK) { 
+		fec_deliver(p); 
+		return; 
+    }
+    if (index > MESH_FEC_MAXBLOCK || (! repair && index == MESH_FEC_MAXBLOCK) || 
+		len > MESH_FEC_MAXLEN) { 
+		debug_output(VERB_ERRORS, "[%s] dropping malformed FEC mesh packet", name().c_str()); 
+		p->kill(); 
+		return; 
+    }
+    b = fec_block(ntohs(mf->mf_block)); 
+
+    if (! repair) { 
+		if (b && (b->mask & (1U << index))) { 
+			_tcpstat.tcps_fec_dup++; 
+			p->kill(); 
+			return; 
+		}
+		if (b) { 
+			b->mask |= 1U << index; 
+			b->count++; 
+			const unsigned char *data = p->data() + sizeof(click_meshfec); 
+			for (unsigned i = 0; i < len; i++) 
+				b->acc[i] ^= data[i]; 
+			b->lenxor ^= len; 
+		}
+		fec_deliver(p); 
+		return; 
+    }
+
+    if (! b || b->done || index == 0 || b->count > index) { 
+		p->kill(); 
+		return; 
+    }
+    int lost = index - b->count; 
+    b->done = true; 
+    _fec.rcv_loss = min((_fec.rcv_loss * 7U + 256U * lost / index) / 8, 255U); 
+    if (lost > 1) 
+		_tcpstat.tcps_fec_lost++; 
+    if (lost != 1 || (unsigned) (lenxor ^ b->lenxor) > len) { 
+		p->kill(); 
+		return; 
+    }
+
+    WritablePacket *q = p->uniqueify(); 
+    if (! q) 
+		return; 
+    unsigned char *data = q->data() + sizeof(click_meshfec); 
+    for (unsigned i = 0; i < len; i++) 
+		data[i] ^= b->acc[i]; 
+    q->take(len - (lenxor ^ b->lenxor)); 
+    b->mask = 0xffffffffU; 
+    _tcpstat.tcps_fec_rebuilt++; 
+    fec_deliver(q); 
+}
+
+
+/* MESH_FEC: strip the FEC header and hand the packet on as if it had
+ * arrived without one */
+void
+TCPSpeaker::fec_deliver(Packet *p)
+{
+    p->pull(sizeof(click_meshfec)); 
+    if (p->length() >= sizeof(click_meshhdr) && mesh_is_compact(p->data())) { 
+		p->set_network_header(p->data(), 0); 
+    } else if (p->length() >= sizeof(click_ip) && (p->data()[0] >> 4) == 4) { 
+		p->set_ip_header(reinterpret_cast<const click_ip *>(p->data()), 
+			(p->data()[0] & 0xf) << 2); 
+    } else { 
+		p->kill(); 
+		return; 
+    }
+    mesh_push(p); 
+}
+
+
+/* MESH_CC: wake the puller at <t>, unless it is woken earlier already */
+void
+TCPSpeaker::mesh_cc_wake_at(const Timestamp &t)
+{
+    if (! _meshcc_timer->scheduled() || t < _meshcc_timer->expiry()) 
+		_meshcc_timer->schedule_at(t); 
+}
+
+
+/* MESH_CC: refill the token bucket at the current rate. Without tokens
+ * the output sleeps until there are some again. */
+bool
+TCPSpeaker::mesh_cc_admit()
+{
+    tcp_meshcc &cc = _meshcc; 
+    Timestamp now = Timestamp::now(); 
+    int64_t burst = max((int64_t) MESH_CC_BURST, (int64_t) cc.rate / 500); 
+
+    cc.tokens += (now - cc.refill).usecval() * cc.rate / 1000000; 
+    cc.refill = now; 
+    if (cc.tokens > burst) 
+		cc.tokens = burst; 
+    if (cc.tokens > 0) 
+		return true; 
+
+    int64_t usec = (1 - cc.tokens) * 1000000 / cc.rate + 1; 
+    cc.limited = true; 
+    cc.held++; 
+    empty_note(TCPS_STATELESS_OUTPUT)->sleep(); 
+    mesh_cc_wake_at(now + Timestamp::make_usec(usec / 1000000, usec % 1000000)); 
+    return false; 
+}
+
+
+/* MESH_CC: number and timestamp a compact packet, and tell the peer what
+ * we have seen of its packets */
+void
+TCPSpeaker::mesh_hop_stamp(click_meshhop *h)
+{
+    tcp_meshcc &cc = _meshcc; 
+
+    h->mo_seq = htons(cc.snd_next++); 
+    h->mo_ts = htons((uint16_t) Timestamp::now().msecval()); 
+    h->mo_lost = htons(cc.rcv_lost); 
+    h->mo_qdelay = htons(cc.qdelay); 
+    cc.fb_due = false; 
+    cc.fb_sent = Timestamp::now(); 
+}
+
+
+/* MESH_CC: learn from the hop fields of a packet of the peer: loss from
+ * gaps in its sequence numbers, queueing from the rise of the one way
+ * delay over the lowest one (which includes the clock offset), and adjust
+ * our rate to what the peer saw of ours. */
+void
+TCPSpeaker::mesh_hop_input(const click_meshhop *h)
+{
+    tcp_meshcc &cc = _meshcc; 
+    Timestamp now = Timestamp::now(); 
+    uint16_t seq = ntohs(h->mo_seq); 
+    uint16_t owd = (uint16_t) now.msecval() - ntohs(h->mo_ts); 
+    uint16_t lost = ntohs(h->mo_lost); 
+
+    if (! cc.rcv_any) { 
+		cc.rcv_any = true; 
+		cc.rcv_next = seq + 1; 
+		cc.owd_min = cc.owd_min_next = owd; 
+		cc.owd_window = now + Timestamp::make_msec(MESH_CC_OWDWINDOW); 
+    } else if ((int16_t) (seq - cc.rcv_next) >= 0) { 
+		cc.rcv_lost += seq - cc.rcv_next; 
+		cc.rcv_next = seq + 1; 
+    }
+    if ((int16_t) (owd - cc.owd_min) < 0) 
+		cc.owd_min = owd; 
+    if ((int16_t) (owd - cc.owd_min_next) < 0) 
+		cc.owd_min_next = owd; 
+    if (now >= cc.owd_window) { 
+		cc.owd_min = cc.owd_min_next; 
+		cc.owd_min_next = owd; 
+		cc.owd_window = now + Timestamp::make_msec(MESH_CC_OWDWINDOW); 
+    }
+    cc.qdelay = (cc.qdelay * 7 + (uint16_t) (owd - cc.owd_min)) / 8; 
+    if (! cc.fb_due) { 
+		cc.fb_due = true; 
+		mesh_cc_wake_at(cc.fb_sent + Timestamp::make_msec(MESH_CC_FBINTERVAL)); 
+    }
+
+    /* the peer's feedback on our packets, loss counted since the last
+     * rate change so none reported during the hold-off is missed */
+    if (! cc.peer_any) 
+		cc.peer_lost_adjust = lost; 
+    cc.peer_any = true; 
+    cc.peer_lost = lost; 
+    cc.peer_qdelay = ntohs(h->mo_qdelay); 
+    if (now - cc.adjust < Timestamp::make_msec(MESH_CC_INTERVAL)) 
+		return; 
+    bool newly = (int16_t) (lost - cc.peer_lost_adjust) > 0; 
+    if (newly || cc.peer_qdelay > _tcp_globals.mesh_cc_target) { 
+		cc.rate = max(cc.rate / 10 * 7, (uint32_t) MESH_CC_MINRATE); 
+		cc.slowstart = false; 
+		cc.cuts++; 
+    } else if (cc.limited) { 
+		cc.rate = cc.slowstart ? cc.rate * 2 : cc.rate + MESH_CC_STEP; 
+		if (cc.rate > MESH_CC_MAXRATE) 
+			cc.rate = MESH_CC_MAXRATE; 
+    } else 
+		return; 
+    cc.limited = false; 
+    cc.adjust = now; 
+    cc.peer_lost_adjust = lost; 
+}
+
+
+/* MESH_CC: with nothing else to carry it, our feedback goes on its own,
+ * at most every MESH_CC_FBINTERVAL */
+Packet *
+TCPSpeaker::mesh_cc_feedback()
+{
+    tcp_meshcc &cc = _meshcc; 
+    Timestamp due = cc.fb_sent + Timestamp::make_msec(MESH_CC_FBINTERVAL); 
+
+    if (! cc.fb_due) 
+		return NULL; 
+    if (Timestamp::now() < due) { 
+		mesh_cc_wake_at(due); 
+		return NULL; 
+    }
+    WritablePacket *p = Packet::make(Packet::default_headroom, 0, 
+		sizeof(click_meshhdr) + sizeof(click_meshhop), 0); 
+    if (! p) 
+		return NULL; 
+    click_meshhdr *mh = reinterpret_cast<click_meshhdr *>(p->data()); 
+    mh->mh_vf = (MESH_VERSION << 4) | MESH_F_HOP; 
+    mh->mh_flags = 0; 
+    mh->mh_tag = 0; 
+    mesh_hop_stamp(reinterpret_cast<click_meshhop *>(mh + 1)); 
+    p->set_network_header(p->data(), 0); 
+    p->set_dst_ip_anno(cc.dst); 
+    return p; 
+}
+
+
+/* MESH_AGG: pull compact mesh packets of any connection into the current
+ * frame until it is full, or the next packet is for another destination,
+ * isn't compact, or doesn't fit. That one is held for the next frame. Once
+ * the connections run dry, a partial frame only leaves after its deadline;
+ * _agg_timer wakes the puller up for it. */
+Packet *
+TCPSpeaker::mesh_agg_pull()
+{
+    unsigned max = _tcp_globals.mesh_agg; 
+    Packet *p; 
+
+    while ((p = _agg_held) || (p = MultiFlowDispatcher::pull(TCPS_STATELESS_OUTPUT))) { 
+		_agg_held = NULL; 
+		unsigned len = p->length(); 
+		bool fits = len >= sizeof(click_meshhdr) && mesh_is_compact(p->data()) && 
+			sizeof(click_meshhdr) + MESH_AGG_CHUNKLEN + len <= max; 
+
+		if (! _agg) { 
+			if (! fits) 
+				return p; 
+			_agg = Packet::make(Packet::default_headroom, 0, sizeof(click_meshhdr), 
+				max - sizeof(click_meshhdr)); 
+			if (! _agg) 
+				return p; 
+			click_meshhdr *mh = reinterpret_cast<click_meshhdr *>(_agg->data()); 
+			mh->mh_vf = (MESH_VERSION << 4) | MESH_F_AGG; 
+			mh->mh_flags = 0; 
+			mh->mh_tag = 0; 
+			_agg->copy_annotations(p); 
+			_agg_deadline = Timestamp::now() + 
+				Timestamp::make_msec(_tcp_globals.mesh_agg_delay); 
+		} else if (! fits || _agg->length() + MESH_AGG_CHUNKLEN + len > max || 
+			p->dst_ip_anno() != _agg->dst_ip_anno()) { 
+			_agg_held = p; 
+			return mesh_agg_finish(); 
+		}
+
+		_agg = _agg->put(MESH_AGG_CHUNKLEN + len); 
+		unsigned char *c = _agg->end_data() - MESH_AGG_CHUNKLEN - len; 
+		c[0] = len >> 8; 
+		c[1] = len & 0xff; 
+		memcpy(c + MESH_AGG_CHUNKLEN, p->data(), len); 
+		p->kill(); 
+
+		click_meshhdr *mh = reinterpret_cast<click_meshhdr *>(_agg->data()); 
+		if (++mh->mh_flags == MESH_AGG_MAXCHUNKS || _agg->length() + 
+			MESH_AGG_CHUNKLEN + sizeof(click_meshhdr) >= max) 
+			return mesh_agg_finish(); 
+    }
+
+    /* without MESH_AGG_DELAY there is no timer, a frame never waits */
+    if (_agg && (! _agg_timer || Timestamp::now() >= _agg_deadline)) 
+		return mesh_agg_finish(); 
+    if (_agg && ! _agg_timer->scheduled()) 
+		_agg_timer->schedule_at(_agg_deadline); 
+    return NULL; 
+}
+
+
+/* MESH_AGG: send the current frame, a lone packet without the frame */
+Packet *
+TCPSpeaker::mesh_agg_finish()
+{
+    WritablePacket *f = _agg; 
+    click_meshhdr *mh = reinterpret_cast<click_meshhdr *>(f->data()); 
+
+    _agg = NULL; 
+    if (_agg_timer) 
+		_agg_timer->unschedule(); 
+    if (mh->mh_flags == 1) 
+		f->pull(sizeof(click_meshhdr) + MESH_AGG_CHUNKLEN); 
+    else { 
+		_tcpstat.tcps_sndmeshagg++; 
+		_tcpstat.tcps_sndmeshchunks += mh->mh_flags; 
+    }
+    f->set_network_header(f->data(), 0); 
+    return f; 
+}
+
+
+/* MESH_COMPACT: hand out the next free receive tag. 0 means none, so the
+ * connection sticks to the full format if all are taken. */
+uint16_t
+TCPSpeaker::mesh_tag_alloc(TCPConnection *con)
+{
+    if (_mesh_tags.size() >= 0xffff) 
+		return 0; 
+    do 
+		_mesh_tag_next++; 
+    while (! _mesh_tag_next || _mesh_tags.get(_mesh_tag_next)); 
+    _mesh_tags.set(_mesh_tag_next, con); 
+    return _mesh_tag_next; 
+}
+
+
+bool
+TCPSpeaker::is_syn(const int port, const Packet * p) { 
+
+    const click_tcp *tcph= p->tcp_header();
+
+    /* A mesh packet opens a connection if it carries data or the SYN
+     * signal. Signals and acknowledgements for a connection that is gone
+     * are dropped silently. */
+    if (port == TCPS_STATELESS_INPUT) { 
+		const click_ip *iph = p->ip_header(); 
+		unsigned hlen = (iph->ip_hl << 2) + (tcph->th_off << 2); 
+		if (tcph->th_flags & TH_RST) 
+			return false; 
+		return (tcph->th_flags & TH_SYN) || ntohs(iph->ip_len) > hlen; 
+    }
+
+    if (tcph->th_flags == TH_SYN) {  
+		debug_output(VERB_PACKETS, "[%s] received a syn packet\n", name().c_str()); 
+		return true; 
     } 
+	
+    debug_output(VERB_PACKETS, "[%s] received a non-syn packet, sending reset\n", name().c_str()); 
+
+    const click_ip  *iph = p->ip_header();
+
+    WritablePacket * wp = Packet::make(sizeof(click_ip) + sizeof(click_tcp)); 
+
+    wp->set_network_header(wp->data(), sizeof(click_ip)); 
+
+    
+    click_ip * rst_iph = wp->ip_header(); 
+    click_tcp *rst_tcph = wp->tcp_header(); 
+    memcpy(rst_iph, iph, sizeof(click_ip)); 
+
+    rst_iph->ip_len = htons(wp->length());
+    rst_iph->ip_src = iph->ip_dst; 
+    rst_iph->ip_dst = iph->ip_src;  
+    
+    rst_tcph->th_sport = tcph->th_dport;
+    rst_tcph->th_dport = tcph->th_sport; 
+    rst_tcph->th_off = (sizeof(click_tcp)) >> 2;
+    rst_tcph->th_ack = tcph->th_seq; 
+    rst_tcph->th_seq = tcph->th_ack; 
+
+    rst_tcph->th_flags = TH_RST; 
+    if (_tcp_globals.checksum) 
+		tcp_ip_checksum(rst_iph, wp->length(), TCP_CSUM_UNKNOWN); 
+
+    output(TCPS_STATEFULL_OUTPUT).push(wp); 
+
+    return false; 
+} 
+
+
+String
+TCPSpeaker::read_gro(Element *e, void *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	StringAccum sa;
+	sa << "merged: " << tcps->_tcpstat.tcps_rcvcoalesced << "\n";
+	return sa.take_string();
+}
+
+
+/* FASTOPEN: the cookie of a client address, a lookup3 mix of the address
+ * and our key. Not a cryptographic MAC, it only has to keep off clients
+ * that haven't been handed a cookie before. */
+void
+TCPSpeaker::tfo_cookie(uint32_t addr, u_char *cookie)
+{
+    uint32_t a = _tfo_key[0] ^ addr, b = _tfo_key[1], c = _tfo_key[2]; 
+    uint32_t w[2]; 
+
+    final(a, b, c); 
+    w[0] = c; 
+    a ^= _tfo_key[3]; 
+    final(a, b, c); 
+    w[1] = c; 
+    memcpy(cookie, w, TCP_FASTOPEN_COOKIELEN); 
+}
+
+
+bool
+TCPSpeaker::tfo_cookie_valid(uint32_t addr, const u_char *cookie, int len)
+{
+    u_char ours[TCP_FASTOPEN_COOKIELEN]; 
+
+    if (len != TCP_FASTOPEN_COOKIELEN) 
+		return false; 
+    tfo_cookie(addr, ours); 
+    return memcmp(ours, cookie, TCP_FASTOPEN_COOKIELEN) == 0; 
+}
+
+
+const tcp_fastopen_cookie *
+TCPSpeaker::tfo_cache_get(uint32_t addr)
+{
+    HashTable<uint32_t, tcp_fastopen_cookie>::iterator it = _tfo_cache.find(addr); 
+    return it ? &it.value() : NULL; 
+}
+
+
+/* Remember a server's cookie. A full cache starts over, which costs the
+ * servers dropped one more round trip for their next connection. */
+void
+TCPSpeaker::tfo_cache_set(uint32_t addr, const u_char *cookie, int len)
+{
+    tcp_fastopen_cookie c; 
+
+    if (_tfo_cache.size() >= TCP_FASTOPEN_CACHE && ! _tfo_cache.find(addr)) 
+		_tfo_cache.clear(); 
+    c.len = len; 
+    memcpy(c.cookie, cookie, len); 
+    _tfo_cache.set(addr, c); 
+}
+
+
+/* HOSTCACHE: the entry of a peer, a new one if <create>. A full cache
+ * starts over. */
+tcp_hostcache *
+TCPSpeaker::hostcache_get(uint32_t addr, bool create)
+{
+    HashTable<uint32_t, tcp_hostcache>::iterator it; 
+    tcp_hostcache hc; 
+
+    addr &= _tcp_globals.hostcache_mask; 
+    it = _hostcache.find(addr); 
+    if (it || ! create) 
+		return it ? &it.value() : NULL; 
+    if (_hostcache.size() >= TCP_HOSTCACHE) 
+		_hostcache.clear(); 
+    memset(&hc, 0, sizeof(hc)); 
+    _hostcache.set(addr, hc); 
+    return &_hostcache.find(addr).value(); 
+}
+
+
+String
+TCPSpeaker::read_mesh_cc(Element *e, void *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	const tcp_meshcc &cc = tcps->_meshcc; 
+	StringAccum sa;
+	sa << "rate: " << cc.rate << "\n";
+	sa << "slowstart: " << (cc.slowstart ? "true" : "false") << "\n";
+	sa << "cuts: " << cc.cuts << "\n";
+	sa << "held: " << cc.held << "\n";
+	sa << "peer lost: " << cc.peer_lost << "\n";
+	sa << "peer qdelay_ms: " << cc.peer_qdelay << "\n";
+	sa << "lost: " << cc.rcv_lost << "\n";
+	sa << "qdelay_ms: " << cc.qdelay << "\n";
+	return sa.take_string();
+}
+
+
+String
+TCPSpeaker::read_mesh_arq(Element *e, void *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	const tcpstat &s = tcps->_tcpstat; 
+	StringAccum sa;
+	sa << "resent: " << s.tcps_arq_rexmt << "\n";
+	sa << "reported missing: " << s.tcps_arq_nack << "\n";
+	sa << "timed out: " << s.tcps_arq_timeout << "\n";
+	sa << "acks sent: " << s.tcps_arq_ackonly << "\n";
+	sa << "out of order: " << s.tcps_arq_ooo << "\n";
+	sa << "duplicates: " << s.tcps_arq_dup << "\n";
+	sa << "beyond window: " << s.tcps_arq_outwin << "\n";
+	sa << "given up: " << s.tcps_arq_giveup << "\n";
+	return sa.take_string();
+}
+
+
+String
+TCPSpeaker::read_mesh_fec(Element *e, void *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	const tcp_meshfec &f = tcps->_fec; 
+	const tcpstat &s = tcps->_tcpstat; 
+	StringAccum sa;
+	sa << "block: " << f.snd_k << "\n";
+	sa << "peer loss: " << f.peer_loss * 100 / 256 << "\n";
+	sa << "loss: " << f.rcv_loss * 100 / 256 << "\n";
+	sa << "repairs sent: " << s.tcps_fec_repairs << "\n";
+	sa << "rebuilt: " << s.tcps_fec_rebuilt << "\n";
+	sa << "unrecoverable: " << s.tcps_fec_lost << "\n";
+	sa << "duplicates: " << s.tcps_fec_dup << "\n";
+	return sa.take_string();
+}
+
+
+String
+TCPSpeaker::read_hostcache(Element *e, void *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	StringAccum sa;
+	int prefix = 0; 
+	for (uint32_t m = ntohl(tcps->_tcp_globals.hostcache_mask); m; m <<= 1) 
+		prefix++; 
+	for (HashTable<uint32_t, tcp_hostcache>::iterator it = tcps->_hostcache.begin(); it; ++it) { 
+		const tcp_hostcache &hc = it.value(); 
+		sa << IPAddress(it.key()) << "/" << prefix 
+		   << " srtt_ms " << (hc.srtt * 1000 / (PR_SLOWHZ << TCP_RTT_SHIFT)) 
+		   << " rttvar_ms " << (hc.rttvar * 1000 / (PR_SLOWHZ << TCP_RTTVAR_SHIFT)) 
+		   << " ssthresh " << hc.ssthresh << " cwnd " << hc.cwnd 
+		   << " mss " << hc.mss << " updates " << hc.updates 
+		   << " hits " << hc.hits << "\n";
+	}
+	return sa.take_string();
+}
 
-    StringAccum sa;
-    sa << *(flowid()); 
-    debug_output(VERB_STATES, "[%s] new connection %s %s", SPKRNAME, sa.c_str(), tcpstates[tp->t_state]); 
+
+String
+TCPSpeaker::read_fastopen(Element *e, void *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	StringAccum sa;
+	sa << "cookies sent: " << tcps->_tcpstat.tcps_tfo_cookiesent << "\n";
+	sa << "syn data taken: " << tcps->_tcpstat.tcps_tfo_accepted << "\n";
+	sa << "bad cookies: " << tcps->_tcpstat.tcps_tfo_badcookie << "\n";
+	sa << "syn data sent: " << tcps->_tcpstat.tcps_tfo_syndata << "\n";
+	sa << "syn data acked: " << tcps->_tcpstat.tcps_tfo_synacked << "\n";
+	sa << "cached cookies: " << tcps->_tfo_cache.size() << "\n";
+	return sa.take_string();
 }
 
 
-//Return the number of TCPConnections in the HandlerQueue of this TCPSpeaker
 String
-TCPSpeaker::read_num_connections(Element *e, void *)
+TCPSpeaker::read_mesh_agg(Element *e, void *)
 {
-  	TCPSpeaker *tcps = (TCPSpeaker *)e;
-	int buckets = tcps->num_connections();
-	return String(buckets);
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	StringAccum sa;
+	sa << "frames sent: " << tcps->_tcpstat.tcps_sndmeshagg << "\n";
+	sa << "packets in them: " << tcps->_tcpstat.tcps_sndmeshchunks << "\n";
+	sa << "frames received: " << tcps->_tcpstat.tcps_rcvmeshagg << "\n";
+	return sa.take_string();
 }
 
 
-// Iterate over all TCPConnections and pass the packet pointer to each
-// connection, have that connection write its _q_recv value at that address, and
-// then return how many bytes it wrote or -1 if unable to write anymore.
-// Return the number of bytes written or -1 if one of the connections returned
-// -1
-int
-TCPSpeaker::iter_connections(void *address, int remainingbytes)
+// Report how much per-connection state is currently allocated
+String
+TCPSpeaker::read_memory(Element *e, void *)
 {
-	int result = 0;
-	for (MFHIterator mfhs = all_handlers_iterator(); mfhs; ++mfhs) {
-		const char *key = mfhs.key().unparse().c_str();
-		const int val = dynamic_cast<TCPConnection *>(mfhs.value())->so_recv_buffer_space();
-		click_chatter("[%s] -> [%d]", key, val);
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	StringAccum sa;
+	sa << "connections: " << tcps->num_connections() << "\n";
+	sa << "tcpcbs: " << tcps->_mem.tcpcbs << "\n";
+	sa << "fifo_rings: " << tcps->_mem.fifo_rings << "\n";
+	sa << "sizeof_connection: " << sizeof(TCPConnection) << "\n";
+	sa << "sizeof_tcpcb: " << sizeof(tcpcb) << "\n";
+	sa << "sizeof_fifo_ring: " << (sizeof(WritablePacket *) * FIFO_SIZE) << "\n";
+#if CLICK_USERLEVEL
+	long size = 0, resident = 0;
+	if (FILE *f = fopen("/proc/self/statm", "r")) {
+		if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
 	}
+	sa << "rss_kb: " << (resident * (sysconf(_SC_PAGESIZE) / 1024)) << "\n";
+#endif
+	return sa.take_string();
+}
 
-	if (address || remainingbytes) {};
 
-	// Iterate over mfd_hash and obtain the following for each TCPConnection
-	// write the following into the string:
-	// 32bits srcaddr
-	// 32bits dstaddr
-	// 16bits srcport
-	// 16bits dstport 
-	// 32bits TCPConnection::so_recv_buffer_space()
-//	result.append("ffffffff", 8);
-//	click_chatter("printing [%s]", result.c_str());
-	return result;
+void
+TCPSpeaker::record_fct(TCPConnection *con)
+{
+	Timestamp fct = Timestamp::now() - con->_created; 
+	_fct.usec[_fct.next] = fct.usecval(); 
+	_fct.bytes[_fct.next] = con->attained(TCPS_STATELESS_OUTPUT); 
+	_fct.next = (_fct.next + 1) % TCPS_FCT_SAMPLES; 
+	if (_fct.count < TCPS_FCT_SAMPLES) 
+		_fct.count++; 
+	con->_created = Timestamp(); 
 }
 
 
-bool
-TCPSpeaker::is_syn(const Packet * p) { 
+static int
+fct_compare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b; 
+	return x < y ? -1 : (x > y ? 1 : 0); 
+}
 
-    const click_tcp *tcph= p->tcp_header();
 
-    if (tcph->th_flags == TH_SYN) {  
-		debug_output(VERB_PACKETS, "[%s] received a syn packet\n", name().c_str()); 
-		return true; 
-    } 
-	
-    debug_output(VERB_PACKETS, "[%s] received a non-syn packet, sending reset\n", name().c_str()); 
+static void
+fct_percentiles(StringAccum &sa, const char *prefix, Vector<uint32_t> &v)
+{
+	int n = v.size(); 
+	if (n) 
+		click_qsort(&v[0], n, sizeof(uint32_t), fct_compare); 
+	sa << prefix << "flows: " << n << "\n";
+	sa << prefix << "p50_us: " << (n ? v[(n - 1) * 50 / 100] : 0) << "\n";
+	sa << prefix << "p90_us: " << (n ? v[(n - 1) * 90 / 100] : 0) << "\n";
+	sa << prefix << "p99_us: " << (n ? v[(n - 1) * 99 / 100] : 0) << "\n";
+}
 
-    const click_ip  *iph = p->ip_header();
 
-    WritablePacket * wp = Packet::make(sizeof(click_ip) + sizeof(click_tcp)); 
+// Report flow completion time percentiles, for all and for small flows
+String
+TCPSpeaker::read_fct(Element *e, void *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	const tcp_fctstat &f = tcps->_fct; 
+	Vector<uint32_t> all, small; 
+	StringAccum sa;
+
+	for (int i = 0; i < f.count; i++) { 
+		all.push_back(f.usec[i]); 
+		if (f.bytes[i] < tcps->las_threshold()) 
+			small.push_back(f.usec[i]); 
+	}
+	fct_percentiles(sa, "", all); 
+	fct_percentiles(sa, "small_", small); 
+	return sa.take_string();
+}
 
-    wp->set_network_header(wp->data(), sizeof(click_ip)); 
 
-    
-    click_ip * rst_iph = wp->ip_header(); 
-    click_tcp *rst_tcph = wp->tcp_header(); 
-    memcpy(rst_iph, iph, sizeof(click_ip)); 
+int
+TCPSpeaker::write_fct_reset(const String &, Element *e, void *, ErrorHandler *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	memset(&tcps->_fct, 0, sizeof(tcps->_fct)); 
+	return 0;
+}
 
-    rst_iph->ip_len = htons(wp->length());
-    rst_iph->ip_src = iph->ip_dst; 
-    rst_iph->ip_dst = iph->ip_src;  
-    
-    rst_tcph->th_sport = tcph->th_dport;
-    rst_tcph->th_dport = tcph->th_sport; 
-    rst_tcph->th_off = (sizeof(click_tcp)) >> 2;
-    rst_tcph->th_ack = tcph->th_seq; 
-    rst_tcph->th_seq = tcph->th_ack; 
 
-    rst_tcph->th_flags = TH_RST; 
+#if TCPSPEAKER_CYCLES
+static const char * const tcp_cyclestat_names[TCPS_CYC_NSTATS] = { 
+	"tcp_input", "usrsend", "tcp_options" 
+}; 
 
-    output(TCPS_STATEFULL_OUTPUT).push(wp); 
+String
+TCPSpeaker::read_cycles(Element *e, void *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	StringAccum sa;
+	for (int i = 0; i < TCPS_CYC_NSTATS; i++) { 
+		uint64_t n = tcps->_cycles.count[i]; 
+		sa << tcp_cyclestat_names[i] << ": " << n << " packets, " 
+		   << (n ? tcps->_cycles.cycles[i] / n : 0) << " cycles/packet\n"; 
+	}
+	return sa.take_string();
+}
 
-    return false; 
-} 
+
+int
+TCPSpeaker::write_cycles(const String &, Element *e, void *, ErrorHandler *)
+{
+	TCPSpeaker *tcps = (TCPSpeaker *)e;
+	memset(&tcps->_cycles, 0, sizeof(tcps->_cycles)); 
+	return 0;
+}
+#endif
 
 
 //Return the verbosity bitmask of TCPConnections in the HandlerQueue of this TCPSpeaker
@@ -2126,7 +4295,22 @@ TCPSpeaker::write_verb(const String &s, Element *e, void *, ErrorHandler *errh)
 void
 TCPSpeaker::add_handlers()
 {
+    MultiFlowDispatcher::add_handlers(); 
     add_read_handler("num_connections", read_num_connections, (void *)0);
+    add_read_handler("memory", read_memory, (void *)0);
+    add_read_handler("gro", read_gro, (void *)0);
+    add_read_handler("mesh_agg", read_mesh_agg, (void *)0);
+    add_read_handler("fastopen", read_fastopen, (void *)0);
+    add_read_handler("hostcache", read_hostcache, (void *)0);
+    add_read_handler("mesh_cc", read_mesh_cc, (void *)0);
+    add_read_handler("mesh_arq", read_mesh_arq, (void *)0);
+    add_read_handler("mesh_fec", read_mesh_fec, (void *)0);
+    add_read_handler("fct", read_fct, (void *)0);
+    add_write_handler("fct_reset", write_fct_reset, (void *)0, Handler::BUTTON);
+#if TCPSPEAKER_CYCLES
+    add_read_handler("cycles", read_cycles, (void *)0);
+    add_write_handler("cycles", write_cycles, (void *)0);
+#endif
     add_read_handler("verb", read_verb, (void *)0);
     add_write_handler("verb", write_verb, (void *)0, Handler::NONEXCLUSIVE);
 }
@@ -2176,8 +4360,6 @@ void *TCPSpeaker::cast(const char *name) {
 	return (TCPSpeaker *) this;
     else if (strcmp(name, "MultiFlowDispatcher") == 0)
 	return (MultiFlowDispatcher *) this;
-    else if (strcmp(name, Notifier::EMPTY_NOTIFIER) == 0)
-		return static_cast<Notifier *>(empty_note()); 
     else
 	return
 	    MultiFlowDispatcher::cast(name);
@@ -2203,6 +4385,11 @@ TCPSpeaker::configure(Vector<String> &conf, ErrorHandler * errh)
     } */
 
     memset(&_tcpstat, 0, sizeof(_tcpstat)); 
+    memset(&_mem, 0, sizeof(_mem)); 
+    memset(&_fct, 0, sizeof(_fct)); 
+#if TCPSPEAKER_CYCLES
+    memset(&_cycles, 0, sizeof(_cycles)); 
+#endif
     _errh = errh; 
 
     /* _empty_note.initialize(Notifier::EMPTY_NOTIFIER, router()); */
@@ -2216,8 +4403,30 @@ TCPSpeaker::configure(Vector<String> &conf, ErrorHandler * errh)
     _tcp_globals.tcp_rttdflt	    = TCPTV_SRTTDFLT / PR_SLOWHZ;
     _tcp_globals.so_flags	   	 	= 0; 
     _tcp_globals.so_idletime	    = 0; 
+    _tcp_globals.window_scale	    = 0; 
+    _tcp_globals.use_timestamp	    = true; 
+    _tcp_globals.checksum	   	    = false; 
+    _tcp_globals.gso_size	   	    = 0; 
+    _tcp_globals.gro_size	   	    = 0; 
+    _tcp_globals.nagle	   		    = false; 
+    _tcp_globals.mesh_mtu	   	    = 0; 
+    _tcp_globals.mesh_delay	   	    = 2; 
+    _tcp_globals.mesh_compact	    = false; 
+    _tcp_globals.mesh_agg	   	    = 0; 
+    _tcp_globals.mesh_agg_delay	    = 1; 
+    _tcp_globals.early_connect	    = false; 
+    _tcp_globals.fastopen	   	    = false; 
+    _tcp_globals.hostcache	   	    = false; 
+    _tcp_globals.pacing	   		    = false; 
+    _tcp_globals.mesh_cc	   	    = false; 
+    _tcp_globals.mesh_cc_target	    = 20; 
+    _tcp_globals.mesh_arq	   	    = false; 
+    _tcp_globals.mesh_arq_window    = 65536; 
+    _tcp_globals.mesh_fec	   	    = false; 
+    _tcp_globals.mesh_fec_block	    = 16; 
     _verbosity 						= VERB_ERRORS; 
 
+    unsigned hc_prefix = 32; 
     bool so_flags_array[32]; 
     bool t_flags_array[10]; 
     memset(so_flags_array, 0, 32 * sizeof(bool)); 
@@ -2230,6 +4439,26 @@ TCPSpeaker::configure(Vector<String> &conf, ErrorHandler * errh)
 		"RCVBUF", 	0, cpUnsigned, &(_tcp_globals.so_recv_buffer_size),
 		"WINDOW_SCALING", 0, cpUnsigned, &(_tcp_globals.window_scale),
 		"USE_TIMESTAMPS", 0, cpBool, &(_tcp_globals.use_timestamp),
+		"CHECKSUM", 0, cpBool, &(_tcp_globals.checksum),
+		"GSO", 		0, cpUnsigned, &(_tcp_globals.gso_size),
+		"GRO", 		0, cpUnsigned, &(_tcp_globals.gro_size),
+		"NAGLE", 	0, cpBool, &(_tcp_globals.nagle),
+		"MESH_MTU", 0, cpUnsigned, &(_tcp_globals.mesh_mtu),
+		"MESH_DELAY", 0, cpUnsigned, &(_tcp_globals.mesh_delay),
+		"MESH_COMPACT", 0, cpBool, &(_tcp_globals.mesh_compact),
+		"MESH_AGG", 0, cpUnsigned, &(_tcp_globals.mesh_agg),
+		"MESH_AGG_DELAY", 0, cpUnsigned, &(_tcp_globals.mesh_agg_delay),
+		"EARLY_CONNECT", 0, cpBool, &(_tcp_globals.early_connect),
+		"FASTOPEN", 0, cpBool, &(_tcp_globals.fastopen),
+		"HOSTCACHE", 0, cpBool, &(_tcp_globals.hostcache),
+		"PACING", 	0, cpBool, &(_tcp_globals.pacing),
+		"MESH_CC", 	0, cpBool, &(_tcp_globals.mesh_cc),
+		"MESH_CC_TARGET", 0, cpUnsigned, &(_tcp_globals.mesh_cc_target),
+		"MESH_ARQ", 	0, cpBool, &(_tcp_globals.mesh_arq),
+		"MESH_ARQ_WINDOW", 0, cpUnsigned, &(_tcp_globals.mesh_arq_window),
+		"MESH_FEC", 	0, cpBool, &(_tcp_globals.mesh_fec),
+		"MESH_FEC_BLOCK", 0, cpUnsigned, &(_tcp_globals.mesh_fec_block),
+		"HOSTCACHE_PREFIX", 0, cpUnsigned, &hc_prefix,
 		"FIN_AFTER_TCP_FIN",  0, cpBool, &(so_flags_array[8]), 
 		"FIN_AFTER_TCP_IDLE", 0, cpBool, &(so_flags_array[9]), 
 		"FIN_AFTER_UDP_IDLE", 0, cpBool, &(so_flags_array[10]), 
@@ -2245,6 +4474,45 @@ TCPSpeaker::configure(Vector<String> &conf, ErrorHandler * errh)
     _tcp_globals.so_idletime *= PR_SLOWHZ; 
     if (_tcp_globals.window_scale > TCP_MAX_WINSHIFT) 
 		_tcp_globals.window_scale = TCP_MAX_WINSHIFT; 
+    unsigned sl_hlen = sizeof(click_ip) + sizeof(click_tcp) + 
+		(_tcp_globals.mesh_compact ? TCPOLEN_MESHTAG : 0) + 
+		(_tcp_globals.mesh_arq ? MESH_ARQ_SACKOPTLEN : 0) + 
+		(_tcp_globals.mesh_fec ? sizeof(click_meshfec) : 0); 
+    if (_tcp_globals.mesh_mtu && _tcp_globals.mesh_mtu <= sl_hlen) 
+		return errh->error("MESH_MTU must leave room behind the %u byte stateless header", 
+			sl_hlen); 
+    if (hc_prefix > 32) 
+		return errh->error("HOSTCACHE_PREFIX must be between 0 and 32"); 
+    _tcp_globals.hostcache_mask = hc_prefix ? htonl(0xffffffffU << (32 - hc_prefix)) : 0; 
+    for (int i = 0; i < 4; i++) 
+		_tfo_key[i] = click_random() << 16 ^ click_random(); 
+    if (_tcp_globals.mesh_agg && ! _tcp_globals.mesh_compact) 
+		return errh->error("MESH_AGG only aggregates compact mesh packets, set MESH_COMPACT"); 
+    if (_tcp_globals.mesh_cc && ! _tcp_globals.mesh_compact) 
+		return errh->error("MESH_CC needs the compact mesh header, set MESH_COMPACT"); 
+    /* sequence numbers are compared within half their space */
+    if (_tcp_globals.mesh_arq && (_tcp_globals.mesh_arq_window == 0 || 
+		_tcp_globals.mesh_arq_window > 0x40000000)) 
+		return errh->error("MESH_ARQ_WINDOW must be between 1 and 2^30 bytes"); 
+    if (_tcp_globals.mesh_fec && (_tcp_globals.mesh_fec_block < MESH_FEC_MINBLOCK || 
+		_tcp_globals.mesh_fec_block > MESH_FEC_MAXBLOCK)) 
+		return errh->error("MESH_FEC_BLOCK must be between %d and %d packets", 
+			MESH_FEC_MINBLOCK, MESH_FEC_MAXBLOCK); 
+    if (_tcp_globals.mesh_agg && _tcp_globals.mesh_agg <= 
+		2 * sizeof(click_meshhdr) + MESH_AGG_CHUNKLEN) 
+		return errh->error("MESH_AGG too small for even one chunk"); 
+    /* chunk lengths are 16 bit */
+    if (_tcp_globals.mesh_agg > 0xffff) 
+		_tcp_globals.mesh_agg = 0xffff; 
+    /* a super-segment still has to fit into one IP packet */
+    if (_tcp_globals.gso_size > 0xffff - (int) sizeof(click_ip) - 
+		(int) sizeof(click_tcp) - MAX_TCPOPTLEN) 
+		_tcp_globals.gso_size = 0xffff - sizeof(click_ip) - 
+			sizeof(click_tcp) - MAX_TCPOPTLEN; 
+    if (_tcp_globals.gro_size > 0xffff - (int) sizeof(click_ip) - 
+		(int) sizeof(click_tcp) - MAX_TCPOPTLEN) 
+		_tcp_globals.gro_size = 0xffff - sizeof(click_ip) - 
+			sizeof(click_tcp) - MAX_TCPOPTLEN; 
 
     return 0 ;
 }
@@ -2262,6 +4530,59 @@ TCPSpeaker::initialize(ErrorHandler *errh)
 	_slow_ticks->initialize(this);
 	_slow_ticks->schedule_after_msec(TCP_SLOW_TICK_MS); 
 
+	if (dispatch_code(true, TCPS_STATELESS_INPUT) == 
+		(MFD_DISPATCH_MFD_DIRECT | MFD_DISPATCH_PULL)) { 
+		_pull_task = new Task(this); 
+		ScheduleInfo::initialize_task(this, _pull_task, false, errh); 
+	}
+	if (_tcp_globals.gro_size) { 
+		_gro_task = new Task(this); 
+		ScheduleInfo::initialize_task(this, _gro_task, false, errh); 
+	}
+	if (_tcp_globals.mesh_mtu && _tcp_globals.mesh_delay) { 
+		_mesh_timer = new Timer(this); 
+		_mesh_timer->initialize(this); 
+	}
+	if (_tcp_globals.mesh_agg && _tcp_globals.mesh_agg_delay) { 
+		_agg_timer = new Timer(this); 
+		_agg_timer->initialize(this); 
+	}
+	if (_tcp_globals.pacing) { 
+		_pace_timer = new Timer(this); 
+		_pace_timer->initialize(this); 
+	}
+	if (_tcp_globals.mesh_arq) { 
+		_arq_timer = new Timer(this); 
+		_arq_timer->initialize(this); 
+	}
+	if (_tcp_globals.mesh_cc) { 
+		_meshcc_timer = new Timer(this); 
+		_meshcc_timer->initialize(this); 
+		_meshcc.rate = MESH_CC_INITRATE; 
+		_meshcc.slowstart = true; 
+		_meshcc.tokens = MESH_CC_BURST; 
+		_meshcc.refill = _meshcc.adjust = Timestamp::now(); 
+		_meshcc.snd_next = 0; 
+		_meshcc.limited = _meshcc.peer_any = false; 
+		_meshcc.peer_lost = _meshcc.peer_lost_adjust = _meshcc.peer_qdelay = 0; 
+		_meshcc.cuts = _meshcc.held = 0; 
+		_meshcc.rcv_any = _meshcc.fb_due = false; 
+		_meshcc.rcv_lost = _meshcc.qdelay = 0; 
+	}
+	if (_tcp_globals.mesh_fec) { 
+		_fec_timer = new Timer(this); 
+		_fec_timer->initialize(this); 
+		_fec.snd_block = 0; 
+		_fec.snd_count = 0; 
+		_fec.snd_k = _tcp_globals.mesh_fec_block; 
+		_fec.snd_acclen = 0; 
+		_fec.snd_lenxor = 0; 
+		memset(_fec.snd_acc, 0, sizeof(_fec.snd_acc)); 
+		_fec.peer_loss = _fec.rcv_loss = 0; 
+		for (int i = 0; i < MESH_FEC_RCVBLOCKS; i++) 
+			_fec.rcv[i].used = false; 
+	}
+
 	_errh = errh; 
 	return 0; 
 }
@@ -2275,27 +4596,334 @@ TCPSpeaker::run_timer(Timer *t)
 
     if (t == _fast_ticks) {
 		for (; i; i++) {
-			con = dynamic_cast<TCPConnection *>(i->second);
+			con = handler(i);
 			con->fasttimo(); 
 		}
 		_fast_ticks->reschedule_after_msec(TCP_FAST_TICK_MS);
     } else if (t == _slow_ticks) {
 		for (; i; i++) {
-			con = dynamic_cast<TCPConnection *>(i->second);
+			con = handler(i);
 			con->slowtimo(); 
-			if (con->state() == TCPS_CLOSED) {
+			if (con->state() == TCPS_CLOSED && ! con->stateless_signal_pending()) {
 				delete con;
 				break;
 			}
 		}
 		_slow_ticks->reschedule_after_msec(TCP_SLOW_TICK_MS);
 		(globals()->tcp_now)++; 
+    } else if (t == _mesh_timer) { 
+		mesh_wait_expire(); 
+    } else if (t == _agg_timer) { 
+		/* the partial frame is due, the puller went to sleep on us */
+		empty_note(TCPS_STATELESS_OUTPUT)->wake(); 
+    } else if (t == _pace_timer) { 
+		pace_run(); 
+    } else if (t == _meshcc_timer) { 
+		/* tokens or feedback are due */
+		empty_note(TCPS_STATELESS_OUTPUT)->wake(); 
+    } else if (t == _arq_timer) { 
+		arq_run(); 
+    } else if (t == _fec_timer) { 
+		/* the partial block is due */
+		empty_note(TCPS_STATELESS_OUTPUT)->wake(); 
     } else {
 		debug_output(VERB_TIMERS, "%u: TCPSpeaker::run_timer: unknown timer", tcp_now()); 
 	}
 }
 
 
+/* The pull ready queue is circular, _pull_ready points to the connection
+ * that is serviced next. New connections are added at the tail. */
+void
+TCPSpeaker::pull_ready_enqueue(TCPConnection *con) 
+{ 
+	TCPConnection::SpeakerQueueElem *e = con->speaker_queue_elt(); 
+
+	if (e->qid == SPEAKER_Q_PULL_READY) 
+		return; 
+	e->qid = SPEAKER_Q_PULL_READY; 
+	if (! _pull_ready) { 
+		e->next = e->prev = con; 
+		_pull_ready = con; 
+	} else { 
+		e->next = _pull_ready; 
+		e->prev = _pull_ready->_speaker_queue.prev; 
+		e->prev->_speaker_queue.next = con; 
+		_pull_ready->_speaker_queue.prev = con; 
+	}
+	if (! _pull_task->scheduled()) 
+		_pull_task->reschedule(); 
+}
+
+
+void
+TCPSpeaker::pull_ready_dequeue(TCPConnection *con, int qid) 
+{ 
+	TCPConnection::SpeakerQueueElem *e = con->speaker_queue_elt(); 
+
+	if (e->qid == SPEAKER_Q_PULL_READY) { 
+		if (e->next == con) { 
+			_pull_ready = NULL; 
+		} else { 
+			e->prev->_speaker_queue.next = e->next; 
+			e->next->_speaker_queue.prev = e->prev; 
+			if (_pull_ready == con) 
+				_pull_ready = e->next; 
+		}
+		e->next = e->prev = NULL; 
+	}
+	e->qid = qid; 
+}
+
+
+void
+TCPSpeaker::gro_enqueue(TCPConnection *con) 
+{ 
+	con->_gro_next = _gro_list; 
+	_gro_list = con; 
+	if (! _gro_task->scheduled()) 
+		_gro_task->reschedule(); 
+}
+
+
+/* Connections only hold a segment until the task runs, so the list is
+ * short and a linear search is fine */
+void
+TCPSpeaker::gro_dequeue(TCPConnection *con) 
+{ 
+	for (TCPConnection **pp = &_gro_list; *pp; pp = &(*pp)->_gro_next) 
+		if (*pp == con) { 
+			*pp = con->_gro_next; 
+			con->_gro_next = NULL; 
+			return; 
+		}
+}
+
+
+void
+TCPSpeaker::mesh_wait_enqueue(TCPConnection *con) 
+{ 
+	con->_mesh_deadline = Timestamp::now() + 
+		Timestamp::make_msec(_tcp_globals.mesh_delay); 
+	con->_mesh_waiting = true; 
+	con->_mesh_next = NULL; 
+	if (_mesh_wait_tail) 
+		_mesh_wait_tail->_mesh_next = con; 
+	else 
+		_mesh_wait = con; 
+	_mesh_wait_tail = con; 
+	if (! _mesh_timer->scheduled()) 
+		_mesh_timer->schedule_at(_mesh_wait->_mesh_deadline); 
+}
+
+
+void
+TCPSpeaker::mesh_wait_dequeue(TCPConnection *con) 
+{ 
+	TCPConnection *prev = NULL; 
+	for (TCPConnection *c = _mesh_wait; c; prev = c, c = c->_mesh_next) 
+		if (c == con) { 
+			if (prev) 
+				prev->_mesh_next = con->_mesh_next; 
+			else 
+				_mesh_wait = con->_mesh_next; 
+			if (_mesh_wait_tail == con) 
+				_mesh_wait_tail = prev; 
+			break; 
+		}
+	con->_mesh_next = NULL; 
+	con->_mesh_waiting = false; 
+}
+
+
+/* PACING: restore the heap order around _pace_heap[i], whose departure
+ * time changed */
+void
+TCPSpeaker::pace_sift(int i) 
+{ 
+	TCPConnection *con = _pace_heap[i]; 
+	int n = _pace_heap.size(), c; 
+
+	while (i > 0 && con->_pace_next < _pace_heap[(i - 1) / 2]->_pace_next) { 
+		_pace_heap[i] = _pace_heap[(i - 1) / 2]; 
+		_pace_heap[i]->_pace_idx = i; 
+		i = (i - 1) / 2; 
+	}
+	while ((c = 2 * i + 1) < n) { 
+		if (c + 1 < n && _pace_heap[c + 1]->_pace_next < _pace_heap[c]->_pace_next) 
+			c++; 
+		if (! (_pace_heap[c]->_pace_next < con->_pace_next)) 
+			break; 
+		_pace_heap[i] = _pace_heap[c]; 
+		_pace_heap[i]->_pace_idx = i; 
+		i = c; 
+	}
+	_pace_heap[i] = con; 
+	con->_pace_idx = i; 
+}
+
+
+void
+TCPSpeaker::pace_insert(TCPConnection *con) 
+{ 
+	_pace_heap.push_back(con); 
+	pace_sift(_pace_heap.size() - 1); 
+	if (_pace_heap[0] == con) 
+		_pace_timer->schedule_at(con->_pace_next); 
+}
+
+
+void
+TCPSpeaker::pace_remove(TCPConnection *con) 
+{ 
+	int i = con->_pace_idx; 
+	TCPConnection *last = _pace_heap.back(); 
+
+	_pace_heap.pop_back(); 
+	if (last != con) { 
+		_pace_heap[i] = last; 
+		pace_sift(i); 
+	}
+	con->_pace_idx = -1; 
+}
+
+
+/* PACING: send the segments whose departure time has come, one per
+ * connection and turn, since every segment moves its connection's next
+ * departure on */
+void
+TCPSpeaker::pace_run() 
+{ 
+	Timestamp now = Timestamp::now(); 
+
+	while (_pace_heap.size() && _pace_heap[0]->_pace_next <= now) { 
+		TCPConnection *con = _pace_heap[0]; 
+		Packet *p = con->_pace_head; 
+		con->_pace_head = p->next(); 
+		if (! con->_pace_head) 
+			con->_pace_tail = NULL; 
+		p->set_next(NULL); 
+		con->pace_depart(p); 
+		if (con->_pace_head) 
+			pace_sift(0); 
+		else 
+			pace_remove(con); 
+		con->output(TCPS_STATEFULL_OUTPUT).push(p); 
+	}
+	if (_pace_heap.size()) 
+		_pace_timer->schedule_at(_pace_heap[0]->_pace_next); 
+}
+
+
+/* MESH_ARQ: connections are added at the front, and leave once they have
+ * nothing left to time or hand on */
+void
+TCPSpeaker::arq_enqueue(TCPConnection *con) 
+{ 
+	if (con->_arq_listed) 
+		return; 
+	con->_arq_listed = true; 
+	con->_arq_next = _arq_list; 
+	_arq_list = con; 
+	if (! _arq_timer->scheduled()) 
+		_arq_timer->schedule_after_msec(MESH_ARQ_TICK); 
+}
+
+
+void
+TCPSpeaker::arq_dequeue(TCPConnection *con) 
+{ 
+	for (TCPConnection **pp = &_arq_list; *pp; pp = &(*pp)->_arq_next) 
+		if (*pp == con) { 
+			*pp = con->_arq_next; 
+			break; 
+		}
+	con->_arq_listed = false; 
+	con->_arq_next = NULL; 
+}
+
+
+void
+TCPSpeaker::arq_run() 
+{ 
+	Timestamp now = Timestamp::now(); 
+	TCPConnection **pp = &_arq_list; 
+
+	while (TCPConnection *con = *pp) { 
+		if (con->arq_timeout(now)) { 
+			pp = &con->_arq_next; 
+			continue; 
+		}
+		*pp = con->_arq_next; 
+		con->_arq_listed = false; 
+		con->_arq_next = NULL; 
+	}
+	if (_arq_list) 
+		_arq_timer->schedule_after_msec(MESH_ARQ_TICK); 
+}
+
+
+/* The partial packets whose deadline passed may go now */
+void
+TCPSpeaker::mesh_wait_expire() 
+{ 
+	Timestamp now = Timestamp::now(); 
+
+	while (_mesh_wait && _mesh_wait->_mesh_deadline <= now) { 
+		TCPConnection *con = _mesh_wait; 
+		mesh_wait_dequeue(con); 
+		con->_mesh_flush = true; 
+		con->set_pullable(TCPS_STATELESS_OUTPUT, true); 
+	}
+	if (_mesh_wait) 
+		_mesh_timer->schedule_at(_mesh_wait->_mesh_deadline); 
+}
+
+
+/* Service the pull ready queue: every connection gets to pull its quantum,
+ * then the next one is up. Connections whose neighbor ran dry leave the
+ * queue until can_pull() puts them back, those with a full send window wait
+ * for stateless_input_unchoke(). */
+bool
+TCPSpeaker::run_task(Task *task) 
+{ 
+	if (task == _gro_task) { 
+		bool flushed = _gro_list != NULL; 
+		while (_gro_list) 
+			_gro_list->gro_flush(); 
+		return flushed; 
+	}
+	if (task != _pull_task) 
+		return MultiFlowDispatcher::run_task(task); 
+
+	int budget = TCPS_PULL_BUDGET; 
+	int pulled = 0; 
+	bool drained; 
+
+	while (_pull_ready && budget > 0) { 
+		TCPConnection *con = _pull_ready; 
+		int quantum = min(con->pull_quantum(), budget); 
+
+		if (quantum == 0) { 
+			pull_ready_dequeue(con, SPEAKER_Q_PULL_CHOKED); 
+			continue; 
+		}
+		int n = con->pull_stateless_input(quantum, drained); 
+		pulled += n; 
+		budget -= n; 
+
+		if (drained) 
+			pull_ready_dequeue(con, SPEAKER_Q_NONE); 
+		else if (_pull_ready == con) 
+			_pull_ready = con->_speaker_queue.next; 
+	}
+
+	if (_pull_ready) 
+		_pull_task->fast_reschedule(); 
+	return pulled > 0; 
+}
+
+
 /* Code for the (reassembly) queues 
  * 
  *  TODO: (OPTIMIZATION) this is currently allocating and freeing one
@@ -2311,7 +4939,15 @@ TCPQueue::TCPQueue(TCPConnection *con)
 }
 
 
-TCPQueue::~TCPQueue() {}
+TCPQueue::~TCPQueue() 
+{
+	while (_q_first) { 
+		TCPQueueElt *e = _q_first; 
+		_q_first = e->nxt; 
+		e->_p->kill(); 
+		delete e; 
+	}
+}
 
 
 int 
@@ -2503,6 +5139,60 @@ TCPQueue::loop_last()
 	debug_output(VERB_TCPQUEUE, "Looped _q_last to [%u]", last());
 }
 
+/* In-order bytes at the front of the queue, counted up to <max> */
+unsigned
+TCPQueue::ordered_bytes(unsigned max)
+{
+	unsigned n = 0; 
+
+	if (_q_first == NULL || _q_last == NULL) 
+		return 0; 
+	for (TCPQueueElt *e = _q_first; n < max; e = e->nxt) { 
+		n += e->_p->length(); 
+		if (e == _q_last) 
+			break; 
+	}
+	return n; 
+}
+
+
+/* Take up to <len> in-order bytes off the front of the queue as one packet
+ * with <headroom> in front, splitting the last segment if needed. A front
+ * segment of exactly <len> bytes is handed out as is. */
+WritablePacket *
+TCPQueue::pull_bytes(unsigned len, unsigned headroom)
+{
+	unsigned avail = ordered_bytes(len); 
+
+	if (avail == 0) 
+		return NULL; 
+	if (len > avail) 
+		len = avail; 
+	if (_q_first->_p->length() == len) 
+		return pull_front(); 
+
+	WritablePacket *p = Packet::make(headroom, 0, len, 0); 
+	if (!p) 
+		return NULL; 
+
+	for (unsigned done = 0; done < len; ) { 
+		WritablePacket *q = _q_first->_p; 
+		unsigned n = q->length(); 
+		if (n > len - done) { 
+			n = len - done; 
+			memcpy(p->data() + done, q->data(), n); 
+			q->pull(n); 
+			_q_first->seq += n; 
+		} else { 
+			memcpy(p->data() + done, q->data(), n); 
+			pull_front()->kill(); 
+		}
+		done += n; 
+	}
+	return p; 
+}
+
+
 WritablePacket * 
 TCPQueue::pull_front()
 {
@@ -2619,7 +5309,8 @@ TCPQueue::pretty_print(StringAccum &sa, int signed_width)
 TCPFifo::TCPFifo(TCPConnection *con)
 { 
 	_con = con;
-	_q = (WritablePacket**) CLICK_LALLOC(sizeof(WritablePacket *) * FIFO_SIZE); 
+	_q = NULL; 
+	_csum = NULL; 
 	_head = _tail = _bytes = 0; 
 }
 
@@ -2628,7 +5319,25 @@ TCPFifo::~TCPFifo()
 { 
 	for (int i=_tail; i!= _head; i = (i + 1) % FIFO_SIZE)
 	    _q[i]->kill(); 
-	CLICK_LFREE(_q,sizeof(WritablePacket *) * FIFO_SIZE ); 
+	_tail = _head; 
+	if (_q) 
+	    release(); 
+}
+
+
+/* Give the ring back; only valid while the fifo is empty */
+void
+TCPFifo::release()
+{ 
+	assert(is_empty()); 
+	CLICK_LFREE(_q, sizeof(WritablePacket *) * FIFO_SIZE); 
+	_q = NULL; 
+	if (_csum) { 
+		CLICK_LFREE(_csum, sizeof(uint32_t) * FIFO_SIZE); 
+		_csum = NULL; 
+	}
+	_head = _tail = 0; 
+	_con->speaker()->_mem.fifo_rings--; 
 }
 
 
@@ -2636,12 +5345,22 @@ int
 TCPFifo::push(WritablePacket *p)
 { 
 	//click_chatter("tcpfifo::push pushing [%x]", p);
+	if (!_q) { 
+		_q = (WritablePacket**) CLICK_LALLOC(sizeof(WritablePacket *) * FIFO_SIZE); 
+		if (!_q) { 
+			p->kill(); 
+			return -1; 
+		}
+		_con->speaker()->_mem.fifo_rings++; 
+	}
 	if ((_head + 1) % FIFO_SIZE == _tail) {
 	    p->kill(); 
 		//click_chatter("tcpfifo::push had to kill packet");
 	    return -1 ; 
 	}
 	_q[_head] = p; 
+	if (_csum) 
+		_csum[_head] = TCP_CSUM_UNKNOWN; 
 	_bytes += p->length(); 
 	_head = (_head + 1) % FIFO_SIZE; 
 	return 0; 
@@ -2677,32 +5396,81 @@ TCPFifo::pkts_to_send(int offset, int win)
 }
 
 
-/* get a piece of payload starting at <offset> bytes from the tail */ 
+/* Checksum of the payload <len> bytes from <offset>, if that is exactly one
+ * fifo entry. The sum is kept with the entry, so retransmissions of it only
+ * need their headers summed. TCP_CSUM_UNKNOWN otherwise. */
+uint32_t
+TCPFifo::payload_csum(tcp_seq_t offset, unsigned len)
+{ 
+	int wp = _tail; 
+	tcp_seq_t wo = 0; 
+
+	if (is_empty()) return TCP_CSUM_UNKNOWN; 
+
+	while (wo + _q[wp]->length() <= offset) {
+	    wo += _q[wp]->length(); 
+	    wp = (wp + 1) % FIFO_SIZE; 
+	    if (wp == _head) return TCP_CSUM_UNKNOWN; 
+	} 
+	if (wo != offset || _q[wp]->length() != len) 
+		return TCP_CSUM_UNKNOWN; 
+
+	if (!_csum) { 
+		_csum = (uint32_t *) CLICK_LALLOC(sizeof(uint32_t) * FIFO_SIZE); 
+		if (!_csum) 
+			return TCP_CSUM_UNKNOWN; 
+		for (int i = 0; i < FIFO_SIZE; i++) 
+			_csum[i] = TCP_CSUM_UNKNOWN; 
+	}
+	if (_csum[wp] == TCP_CSUM_UNKNOWN) 
+		_csum[wp] = tcps_csum_partial(_q[wp]->data(), len, 0); 
+	return _csum[wp]; 
+}
+
+
+/* get up to <len> bytes of payload starting at <offset> bytes from the tail.
+ * A range within one entry comes from that entry alone; one that spans
+ * several (small) entries, or a GSO super-segment, is gathered into a new
+ * packet with <headroom> bytes in front. */ 
 WritablePacket * 
-TCPFifo::get(tcp_seq_t offset)
+TCPFifo::get(tcp_seq_t offset, unsigned len, unsigned headroom)
 { 
 	WritablePacket * retval; 
 	int wp = _tail; 
 	tcp_seq_t wo = 0; 
 
-	if (is_empty()) return NULL; 
+	if (is_empty() || offset >= _bytes) return NULL; 
 
 	while (wo + _q[wp]->length() <= offset) {
 	    wo += _q[wp]->length(); 
 	    wp = (wp + 1) % FIFO_SIZE; 
-	    if (wp == _head) return NULL; 
 	} 
+	if (len > _bytes - offset) 
+		len = _bytes - offset; 
+
+	if (wo + _q[wp]->length() >= offset + len) { 
+		/* FIXME: this is an expensive packet copy. Maybe there
+		is a better solution.  The problem is: We must keep a copy for later
+		retransmissions and one copy to send out now */ 
+		retval = _q[wp]->clone()->uniqueify(); 
+		if (wo < offset) 
+			retval->pull(offset - wo); 
+		if (retval->length() > len) 
+			retval->take(retval->length() - len); 
+		return retval; 
+	}
 
-	/* FIXME: this is an expensive packet copy. Maybe there
-	is a better solution.  The problem is: We must keep a copy for later
-	retransmissions and one copy to send out now */ 
-
-	retval = _q[wp]->clone()->uniqueify(); 
+	WritablePacket *p = Packet::make(headroom, 0, len, 0); 
+	if (!p) return NULL; 
 
-	if (wo < offset) { 
-		retval->pull(offset - wo); 
+	unsigned skip = offset - wo; 
+	for (unsigned done = 0; done < len; wp = (wp + 1) % FIFO_SIZE) { 
+		unsigned n = min(_q[wp]->length() - skip, len - done); 
+		memcpy(p->data() + done, _q[wp]->data() + skip, n); 
+		done += n; 
+		skip = 0; 
 	}
-	return retval; 
+	return p; 
 }
 
 
@@ -2738,6 +5506,8 @@ TCPFifo::drop_until(tcp_seq_t offset)
 	if (( ! is_empty()) && wo < offset) { 
 		_q[_tail]->pull(offset - wo); 
 		_bytes -= (offset - wo); 
+		if (_csum) 
+			_csum[_tail] = TCP_CSUM_UNKNOWN; 
 	}
 }
 
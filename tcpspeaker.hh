@@ -62,7 +62,280 @@ The stateless packets contain valid minimal TCP/IP headers. Most of the
 fields are ignored. Use other elements to get rid of these headers. 
 The statefull side can be connected to any other TCP speaking entity.
 
-This element does not perform checksumming on either side. 
+The element only computes and checks TCP and IP checksums on the statefull
+side, and only if the CHECKSUM keyword is set: segments leaving on output 1
+then carry valid checksums, and segments arriving on input 0 with a bad TCP
+checksum are counted and dropped before they reach the connection. Without
+it, place SetTCPChecksum and SetIPChecksum behind output 1. The stateless
+side is never checksummed.
+
+With the GSO keyword set to more than the MSS, tcp_output sends bulk data
+as super-segments of up to that many payload bytes, each with the segment
+size in its TCPS_GSO annotation (see TCPSegmenter). Put a TCPSegmenter
+behind output 1 to split them, or leave that to a device that segments by
+itself. The checksums of super-segments are left to the segmenter.
+
+With the GRO keyword set, consecutive in-order data segments of a
+connection that arrive on input 0 back to back, with the same ACK, window
+and options (timestamps included), are merged into one segment of up to
+that many payload bytes before tcp_input sees them. A merged segment is
+acknowledged at once instead of with a delayed ACK.
+
+Segments on output 1 are filled from as many packets of input 1 as fit
+into the MSS. By default data is still sent as soon as it arrives; with
+NAGLE true, less than a full segment waits while sent data is
+unacknowledged (RFC 896), so small mesh payloads leave as full segments.
+
+By default every received segment leaves on output 0 as a mesh packet of
+its own. With MESH_MTU set, in-order received data is repacketized into
+mesh packets of MESH_MTU bytes (stateless headers included) instead. Less
+than that is held for at most MESH_DELAY milliseconds (default 2) after it
+could first have been sent, or until the peer's FIN.
+
+Mesh packets normally carry a full 20 byte IP and 20 byte TCP header. With
+MESH_COMPACT true, every connection advertises a 16 bit tag to its peer in
+a TCP option (kind 253) of those headers, and once a speaker has learned
+its peer's tag it sends a 4 byte compact header with just that tag instead
+(see meshheader.hh). A peer that learns the tag without having any data to
+send answers with a payloadless packet, so the tags are exchanged in both
+directions. Both formats are accepted on input 1, told apart by the
+version nibble; compact packets are looked up by tag, and a packet with an
+unknown tag is dropped without creating a connection. Both speakers of a
+mesh should set it.
+
+The speakers of a connection tell each other about its state with
+stateless signals in the flags of the mesh header, carried by data
+packets or by payloadless ones if there is no data to send: SYN once a
+client has connected, which makes the far side connect to the server
+right away instead of with the first data; FIN once the TCP peer is done
+sending, after the last of its data, which half-closes the far side; and
+RST if a connection closes otherwise, which aborts the far side. Signals
+are acknowledged and resent once a second until they are, at most 5
+times. A closed connection is only released once its signals have been
+acknowledged or given up on. Mesh packets without data or SYN never create
+a connection.
+
+With EARLY_CONNECT true, the SYN signal is already sent when a client's
+SYN arrives, so the far side's handshake with the server overlaps with
+ours instead of following it. Data from the far side waits in its send
+buffer until it is connected. If the server refuses, the far side's RST
+signal aborts the client's connection.
+
+With PACING true, the segments of a connection don't leave back to back
+but spread out over the RTT: at the rate of its congestion window (or the
+peer's window, if smaller) per smoothed RTT, times 2 in slow start and
+1.25 afterwards so the window can keep growing. The RTT is measured in
+microseconds for this; until the first measurement segments are not
+held back. Waiting segments of all connections are kept per connection
+and sent by one timer from a heap ordered by their departure times, so
+connections get their turns fairly instead of whole windows at a time.
+Segments without data only wait if data of their connection is waiting
+already.
+
+With HOSTCACHE true, the speaker remembers the smoothed RTT and its
+variance, the slow start threshold, the last congestion window and the
+MSS of connections to every peer (RFC 2140), grouped by the first
+HOSTCACHE_PREFIX bits (default 32) of its address. They are taken over
+when a connection closes that has measured at least 2 RTTs, averaged
+with what was cached, and seed the next connection to the same peer: its
+retransmit timer starts from the cached RTT instead of 3 seconds, its
+initial window is the cached congestion window (but at most the cached
+threshold, or 10 segments if it was never lowered, and only until the
+handshake times out once), and until the peer's SYN arrives it sends
+segments of the cached MSS. The cache holds at most 4096 peers and starts
+over when full.
+
+With FASTOPEN true, both stateful sides speak TCP Fast Open (RFC 7413).
+Towards servers, the first SYN asks for a cookie, which is cached per
+server address; later SYNs carry the cookie and as much of the data
+already waiting from the mesh as fits into one segment, so the server
+can answer it one round trip earlier. Data the server didn't take with
+the SYN is sent again after the handshake. Towards clients, a SYN with a
+cookie request gets a cookie in the SYN-ACK, and the data in a SYN with a
+valid cookie is taken, so the client needn't send it again; without one
+the data is ignored and the client sends it again. A TCPSpeaker pulling
+output 0 directly only pulls established connections, there the data
+crosses the mesh once the handshake is complete. Cookies are derived from
+the client's address and a random key chosen at configuration time. They
+only keep off clients that never connected before, they are not
+cryptographically strong.
+
+With MESH_AGG set as well, compact packets of different connections that
+are pulled from output 0 for the same destination are packed into one
+aggregate frame of up to MESH_AGG bytes, so a radio pays the channel
+access once for all of them. A partial frame waits at most MESH_AGG_DELAY
+milliseconds (default 1, 0 sends what is there right away) for more. The
+receiving speaker splits aggregate frames on input 1 and hands each chunk
+to its connection. Aggregation needs something that pulls from output 0;
+a TCPSpeaker connected directly to it pulls from the connections instead.
+
+With MESH_CC true (which needs MESH_COMPACT), the rate at which output 0
+can be pulled is limited by a controller shared by all connections
+towards the peer speaker. Both speakers number their compact packets and
+timestamp them, and tell each other in every compact packet how many of
+the other's packets went missing and how much their one way delay rose
+above the lowest seen in the last 10 seconds, which is queueing on the
+hop. If there are no packets to carry this feedback, it is sent on its
+own at most every 10 ms. The rate starts at 1 Mbit/s, doubles every 50
+ms until the first loss or until the queueing delay exceeds
+MESH_CC_TARGET milliseconds (default 20), and then grows by 240 kbit/s
+every 50 ms while the output is busy and is cut to 70% on loss or delay,
+at most every 50 ms. The connections share the rate by the round robin
+(and LAS) order they are pulled in. Both speakers of a mesh should set
+it. Like aggregation, rate control needs something that pulls from output
+0; a TCPSpeaker connected directly to it pulls from the connections
+past the limit, and feedback that has no packet to ride on is never sent.
+
+With MESH_ARQ true, a mesh packet that is lost between two speakers is
+resent by the speaker that sent it, rather than the data going missing.
+Every connection numbers the bytes it sends on output 0, keeps a copy of
+each mesh packet until the peer acknowledges it, and accepts up to
+MESH_ARQ_WINDOW bytes (default 65536) beyond what the peer has
+acknowledged. The receiving side hands the data on in order, holding
+back what arrives after a gap. It acknowledges every second packet, or
+within 5 ms, and reports the first block it holds back. A packet the peer
+reports missing below that block is resent once it has been out for a
+round trip. Other packets are resent after a retransmission timeout
+measured per connection (between 10 ms and 1 s, doubled on every
+timeout). After 8 tries the connection is dropped. The FIN signal waits
+until all data is acknowledged. Data that can't be handed on to the
+stateful side yet is not acknowledged, but is reported as held back, so
+the sender stops at its window instead of resending it. Both speakers
+of a mesh have to set it.
+
+With MESH_FEC true, lost mesh packets can be rebuilt by the receiving
+speaker without waiting a round trip. Packets pulled from output 0 are
+sent in blocks of at most MESH_FEC_BLOCK packets (between 2 and 32,
+default 16), and each block is followed by a repair packet, the XOR of
+the block's packets. Any one missing packet of a block is rebuilt from
+the others and the repair packet. It is then handed on as if it had
+arrived. A block that is not full yet is closed 5 ms after its first
+packet. Both speakers measure the share of blocks' packets lost on the
+way to them and report it in their own packets, and the sender sizes its
+blocks so that about half a packet per block is expected lost: the one
+repair packet then covers most blocks. Packets longer than 2048 bytes
+are not protected. Like aggregation, FEC needs something that pulls from
+output 0, and a speaker's output 0 should lead to one peer speaker. Both
+speakers of a mesh have to set it. MESH_ARQ still resends what FEC can't
+rebuild.
+
+Keyword arguments shared with all MultiFlowDispatchers:
+
+=over 8
+
+=item QUANTUM
+
+Unsigned. Bytes a connection may send on the stateless pull output per
+deficit round robin round before the next connection is served. Scaled by
+the connection's weight. 0 serves one packet per connection and round.
+Default 1500.
+
+=item LAS_LEVELS
+
+Integer between 1 and 8. Number of priority levels for least attained
+service scheduling of the stateless pull output: connections that have
+sent fewer bytes are served first. 1 disables it. Default 1.
+
+=item LAS_THRESHOLD
+
+Unsigned. Bytes a connection may send before it drops from the highest
+priority level. Every following level holds 4 times as many bytes.
+Default 10240.
+
+=item AGING
+
+Unsigned. Milliseconds after which a waiting lower priority level is
+served once, regardless of higher levels. 0 disables aging. Default 100.
+
+=back
+
+=h num_connections read-only
+
+Returns the number of connections currently tracked.
+
+=h verb read/write
+
+Returns or sets the verbosity bitmask.
+
+=h quantum read/write
+
+Returns or sets QUANTUM.
+
+=h flow_weight write-only
+
+Sets the deficit round robin weight of one connection, written as "SADDR
+SPORT DADDR DPORT WEIGHT".
+
+=h fct read-only
+
+Returns the 50th, 90th and 99th percentile flow completion time in
+microseconds, from the creation of a connection until its last data byte
+and FIN are acknowledged, over the last 4096 such connections. Once for
+all of them and once for the small ones that sent less than LAS_THRESHOLD
+bytes on the stateless output.
+
+=h fct_reset write-only
+
+Forgets all flow completion time samples.
+
+=h cycles read/write
+
+Only in builds with TCPSPEAKER_CYCLES defined. Returns the number of
+packets and the average CPU cycles per packet spent in tcp_input (stateful
+input), usrsend (stateless input) and in parsing the TCP options of
+tcp_input. Writing resets the counters.
+
+=h gro read-only
+
+Returns how many segments were merged into a previous one by GRO.
+
+=h mesh_agg read-only
+
+Returns how many aggregate frames were sent, how many mesh packets they
+carried, and how many aggregate frames were received.
+
+=h fastopen read-only
+
+Returns how many Fast Open cookies were handed out, how many SYNs had
+their data taken, how many came with a cookie that wasn't valid, how many
+SYNs were sent with data and how many of those had all of it acknowledged,
+and the number of cached server cookies.
+
+=h hostcache read-only
+
+Returns one line per host cache entry: the peer's address and prefix
+length, the smoothed RTT and its variance in milliseconds, the slow start
+threshold (0 if it was never lowered), the congestion window and MSS in
+bytes, and how often the entry was updated and used.
+
+=h mesh_cc read-only
+
+Returns the current MESH_CC rate in bytes per second, whether it is still
+in slow start, how often it was cut, how often the output was held back,
+the loss count and queueing delay the peer reported last, and the loss
+count and queueing delay of the peer's packets measured here.
+
+=h mesh_arq read-only
+
+Returns how many mesh packets were resent, how many of those the peer
+reported missing and how many timed out, how many acknowledgement-only
+packets were sent, how many packets were received out of order, as
+duplicates or beyond the window, and how many connections were dropped
+for lack of acknowledgements.
+
+=h mesh_fec read-only
+
+Returns the current MESH_FEC block size, the loss the peer reports and
+the loss measured here (in percent), and how many repair packets were
+sent, how many packets were rebuilt, how many blocks lost more than one,
+and how many duplicates were dropped.
+
+=h memory read-only
+
+Returns how many control blocks and send rings are allocated, the size of
+each, and (at userlevel) the resident set size. Control blocks are only
+allocated once a connection is opened; send rings are released again after
+a connection has been idle for a second.
 
 */
 
@@ -75,6 +348,7 @@ This element does not perform checksumming on either side.
 #include <click/notifier.hh>
 #include <click/straccum.hh>
 #include <click/hashtable.hh>
+#include <click/timestamp.hh>
 // #include "netinet/tcp.h"
 #include <clicknet/tcp.h>
 #define TCPOUTFLAGS
@@ -83,6 +357,8 @@ This element does not perform checksumming on either side.
 // #define TCPTIMERS
 #include "tcp_timer.h"
 #include "tcp_var.h"
+#include "tcpcsum.hh"
+#include "meshheader.hh"
 
 #define INCOMING 1
 #define OUTGOING 2
@@ -97,6 +373,25 @@ This element does not perform checksumming on either side.
 
 #define MAX_TCPOPTLEN 40
 
+/* slow ticks without input after which an idle connection hands back its
+ * send ring and pull task */
+#define TCP_IDLE_RELEASE	PR_SLOWHZ
+
+/* shared stateless pull scheduler: packets one connection may pull per
+ * round, and packets pulled per run of the speaker's pull task */
+#define TCPS_PULL_QUANTUM_MAX	32
+#define TCPS_PULL_BUDGET		64
+
+/* stateless signals: slow ticks between retransmissions, and how many
+ * before the far side is given up on */
+#define TCPTV_SL_REXMT		PR_SLOWHZ
+#define TCP_SL_MAXRXT		5
+
+/* values of SpeakerQueueElem::qid */
+#define SPEAKER_Q_NONE			0
+#define SPEAKER_Q_PULL_READY	1	/* in the speaker's pull ready queue */
+#define SPEAKER_Q_PULL_CHOKED	2	/* has input, but the send window is full */
+
 #define TCP_REXMTVAL(tp) \
 	(((tp)->t_srtt >> TCP_RTT_SHIFT) + (tp)->t_rttvar)
 
@@ -180,6 +475,8 @@ class TCPQueue {
 	int push(WritablePacket *p, tcp_seq_t seq, tcp_seq_t seq_nxt);
 	void loop_last();
 	WritablePacket *pull_front();
+	WritablePacket *pull_bytes(unsigned len, unsigned headroom);
+	unsigned ordered_bytes(unsigned max);
 
 	// @Harald: Aren't all of these seq num arithmetic operations unsafe from
 	// wraparound ?
@@ -213,6 +510,8 @@ class TCPQueue {
 };
 
 // The Queue of segments ready to packetize and send via pull
+// The ring of packet pointers is only allocated when the first segment is
+// pushed, and handed back with release() once the connection has gone idle.
 class TCPFifo 
 { 
 	public:
@@ -220,17 +519,21 @@ class TCPFifo
     TCPFifo(TCPConnection *con);
     ~TCPFifo(); 
     int 	push(WritablePacket *);
-    int 	pkt_length() { return (_head - _tail) % FIFO_SIZE; }
+    int 	pkt_length() { return (_head - _tail + FIFO_SIZE) % FIFO_SIZE; }
     bool 	is_empty() { return ( 0 == pkt_length()) ; }
+    bool 	is_allocated() { return _q != NULL; }
+    void 	release(); 
     int 	pkts_to_send(int offset, int win); 
     void 	drop_until (tcp_seq_t offset); 
 
     tcp_seq_t byte_length() { return _bytes; } 
     WritablePacket *pull(); 
-    WritablePacket *get (tcp_seq_t offset); 
+    WritablePacket *get (tcp_seq_t offset, unsigned len, unsigned headroom); 
+    uint32_t	payload_csum(tcp_seq_t offset, unsigned len); 
 
 	protected:
     WritablePacket **_q; 
+    uint32_t	*_csum; 	/* payload sums per ring slot, allocated on demand */
     int 	_head; 
     int 	_tail; 
     int 	_peek_cache_position; 
@@ -253,21 +556,57 @@ struct tcp_globals
 		int 	so_idletime; 
 		int 	window_scale; 
 		bool	use_timestamp; 
+		bool	checksum;		/* CHECKSUM: statefull side checksums */
+		int		gso_size; 		/* GSO: max super-segment payload, 0 off */
+		int		gro_size; 		/* GRO: max merged segment payload, 0 off */
+		bool	nagle; 			/* NAGLE: hold back small segments */
+		unsigned mesh_mtu; 		/* MESH_MTU: repacketize output 0, 0 off */
+		unsigned mesh_delay; 	/* MESH_DELAY: ms to hold partial packets */
+		bool	mesh_compact; 	/* MESH_COMPACT: negotiate compact framing */
+		unsigned mesh_agg; 		/* MESH_AGG: max aggregate frame, 0 off */
+		unsigned mesh_agg_delay; /* MESH_AGG_DELAY: ms to fill a frame */
+		bool	early_connect; 	/* EARLY_CONNECT: SYN signal on client SYN */
+		bool	fastopen; 		/* FASTOPEN: TCP Fast Open on both sides */
+		bool	hostcache; 		/* HOSTCACHE: share metrics per peer */
+		bool	pacing; 		/* PACING: spread segments over the RTT */
+		bool	mesh_cc; 		/* MESH_CC: rate control of output 0 */
+		unsigned mesh_cc_target; /* MESH_CC_TARGET: queueing delay, ms */
+		bool	mesh_arq; 		/* MESH_ARQ: hop-by-hop retransmission */
+		unsigned mesh_arq_window; /* MESH_ARQ_WINDOW: bytes in flight */
+		bool	mesh_fec; 		/* MESH_FEC: repair packets on output 0 */
+		unsigned mesh_fec_block; /* MESH_FEC_BLOCK: max packets per block */
+		uint32_t hostcache_mask; /* HOSTCACHE_PREFIX as a netmask */
 		uint32_t tcp_now;
 		tcp_seq_t so_recv_buffer_size; 
 };
 
+/* MESH_ARQ: timing of the retransmissions between speakers, and a mesh
+ * packet sent and not yet acknowledged */
+#define MESH_ARQ_TICK		5			/* ms between timer runs */
+#define MESH_ARQ_INITRTO	100			/* ms */
+#define MESH_ARQ_MINRTO		10
+#define MESH_ARQ_MAXRTO		1000
+#define MESH_ARQ_MAXRXT		8			/* resends before we give up */
+#define MESH_ARQ_DELACK		2			/* packets per acknowledgement */
+struct tcp_arqseg 
+{ 
+		Packet		*p; 		/* clone of the payload */
+		tcp_seq_t	seq; 
+		Timestamp	sent; 		/* last (re)transmission */
+		short		rxt; 		/* times resent */
+		bool		sacked; 	/* the peer holds it back for reordering */
+		bool		resend; 	/* waiting to be pulled again */
+		tcp_arqseg	*next; 
+};
+
 class TCPSpeaker; 
 
 
-class TCPConnection : public MultiFlowHandler 
+class TCPConnection : public TypedMultiFlowHandler<TCPSpeaker> 
 {
     public: 
 	TCPConnection(TCPSpeaker *, const IPFlowID &id, const char dir); 
-	~TCPConnection() {
-	    debug_output(VERB_MFD_QUEUES, 
-	    "***** DELETING TCPConnection at <%x> ***** \n",
-	    this); }; 
+	~TCPConnection(); 
 	
 	void 	tcp_input(WritablePacket *p);
 	void    push(const int port, Packet *p); 
@@ -281,9 +620,10 @@ class TCPConnection : public MultiFlowHandler
 #define SO_STATE_HASDATA	0x01
 #define SO_STATE_ISCHOKED   0x10
 
-	short state() const { return tp->t_state; } 
+	short state() const { return tp ? tp->t_state : TCPS_CLOSED; } 
 	TCPSpeaker* speaker() const; 
-	bool has_pullable_data() { return !_q_recv.is_empty() && SEQ_LT(_q_recv.first(), tp->rcv_nxt); } 
+	bool has_pullable_data() { return tp && !_q_recv.is_empty() && SEQ_LT(_q_recv.first(), tp->rcv_nxt); } 
+	bool stateless_signal_pending() const { return tp && (tp->t_sl_flags & MESH_SIG_MASK); } 
 	void print_state(StringAccum &sa); 
 	int verbosity() const;
 	
@@ -301,22 +641,144 @@ class TCPConnection : public MultiFlowHandler
 	SpeakerQueueElem * speaker_queue_elt() { return &_speaker_queue; } 
 	int	speaker_queue_id() { return _speaker_queue.qid; }
 
+	/* GRO: the in-order data segment held back for merging, how many
+	 * segments it carries, and the link in the speaker's _gro_list */
+	WritablePacket	*_gro; 
+	int			_gro_segs; 
+	TCPConnection	*_gro_next; 
+	void		gro_input(WritablePacket *p); 
+	bool		gro_merge(WritablePacket *p); 
+	void		gro_flush(); 
+
+	/* MESH_MTU: waiting for more data to fill a mesh packet until
+	 * _mesh_deadline, linked in the speaker's _mesh_wait list; _mesh_flush
+	 * once the deadline has passed */
+	Timestamp	_mesh_deadline; 
+	TCPConnection	*_mesh_next; 
+	bool		_mesh_waiting; 
+	bool		_mesh_flush; 
+	WritablePacket	*mesh_repacketize(); 
+
+	/* PACING: segments waiting for their departure time _pace_next, our
+	 * index in the speaker's _pace_heap (-1 if not in it), and the RTT in
+	 * microseconds our rate follows, measured on the segment starting at
+	 * _pace_rtseq (if _pace_timing), which left the pacer at
+	 * _pace_rtt_start */
+	Packet		*_pace_head; 
+	Packet		*_pace_tail; 
+	Timestamp	_pace_next; 
+	int			_pace_idx; 
+	uint32_t	_pace_srtt_us; 
+	tcp_seq_t	_pace_rtseq; 
+	Timestamp	_pace_rtt_start; 
+	bool		_pace_timing; 
+	void		pace_output(WritablePacket *p); 
+	void		pace_depart(Packet *p); 
+	void		pace_advance(unsigned len); 
+	void		pace_rtt(tcp_seq_t ack); 
+
+	/* MESH_ARQ, sending: mesh packets from _arq_una up to _arq_nxt are
+	 * retained from _arq_head until the peer acknowledges them,
+	 * _arq_resend of them are marked to be pulled again. Receiving: what
+	 * arrives after a gap waits in _arq_rq, _arq_rcv_nxt is the next byte
+	 * to hand on, the block from _arq_sack to _arq_sack_end the first one
+	 * waiting, and _arq_unacked the packets since our last
+	 * acknowledgement. While there is something to time, we are linked
+	 * (_arq_listed) in the speaker's _arq_list. */
+	tcp_arqseg	*_arq_head; 
+	tcp_arqseg	*_arq_tail; 
+	tcp_seq_t	_arq_una; 
+	tcp_seq_t	_arq_nxt; 
+	int			_arq_resend; 
+	uint32_t	_arq_srtt_us; 
+	uint32_t	_arq_rttvar_us; 
+	uint32_t	_arq_rto_us; 
+	TCPQueue	_arq_rq; 
+	tcp_seq_t	_arq_rcv_nxt; 
+	tcp_seq_t	_arq_sack; 
+	tcp_seq_t	_arq_sack_end; 
+	int			_arq_unacked; 
+	bool		_arq_ack_now; 
+	bool		_arq_listed; 
+	TCPConnection	*_arq_next; 
+	bool		arq_window_open() const; 
+	void		arq_stamp(click_mesharq *ma, tcp_seq_t seq); 
+	void		arq_retain(Packet *p, tcp_seq_t seq, unsigned len); 
+	WritablePacket	*arq_resend(); 
+	void		arq_ack_input(const click_mesharq &ma); 
+	int			arq_input(WritablePacket *p, tcp_seq_t seq); 
+	bool		arq_deliver(); 
+	bool		arq_timeout(const Timestamp &now); 
+	void		arq_release(); 
+
+	/* MESH_COMPACT: our receive tag (0 if none), the peer's once learned,
+	 * whether we still advertise ours in the full format, and whether a
+	 * payloadless packet has to carry the advertisement */
+	uint16_t	_mesh_rtag; 
+	uint16_t	_mesh_stag; 
+	bool		_mesh_stag_ok; 
+	bool		_mesh_adv; 
+	bool		_mesh_adv_signal; 
+	void		mesh_input_options(const click_tcp *th, click_mesharq *ma); 
+	unsigned	stateless_hlen() const; 
+
+	int			pull_quantum(); 
+	int			pull_stateless_input(int quantum, bool &drained); 
+	inline void	stateless_input_unchoke(); 
+
     void 		fasttimo();
 	void 		slowtimo();
 	void		tcp_timers(int timer); 
-	int 		stateless_decap(WritablePacket*); 
-	int 		stateless_encap(WritablePacket*); 
+	int 		stateless_decap(WritablePacket*, uint8_t *sl_flags, 
+					click_mesharq *ma, bool *has_arq); 
+	WritablePacket	*stateless_encap(WritablePacket*, tcp_seq_t arq_seq = 0); 
+
+	/* stateless signaling (SYN, FIN, RST) with the far side */
+	void		stateless_signal(uint8_t sig); 
+	uint8_t		stateless_signal_input(uint8_t sl_flags); 
+	uint8_t		stateless_signal_output(); 
+	void		stateless_signal_timeout(); 
 	//TODO give TCPQueue a ref to its connection.
     private: 
-	ErrorHandler	*_errh; 
+	/* tp stays NULL until the connection is opened (tcp_attach), so a
+	 * handler that never sees traffic only costs the object itself */
 	tcpcb 		*tp;
 	TCPFifo		_q_usr_input;
 	TCPQueue	_q_recv; 
 	tcp_seq_t	so_recv_buffer_size; 
+	Timestamp	_created; 	/* for the flow completion time, cleared once
+							 * it is recorded */
 
-	int			_so_state; 
+	bool		tcp_attach(); 
+	void		tcp_template(); 
+	void		tcp_release_idle(); 
 	void 		_tcp_dooptions(u_char *cp, int cnt, const click_tcp *ti, 
 					int *ts_present, u_long *ts_val, u_long *ts_ecr);
+	unsigned	tcp_fastopen_output(int flags, u_char *opt, long &len); 
+	void		tcp_hc_seed(); 
+	void		tcp_hc_update(); 
+	uint32_t	tcp_peer_addr() const; 
+
+	/* Once the handshake is done the options of every segment are known:
+	 * timestamps or not, window scaling or not. _opt_profile points to the
+	 * build/parse pair specialized for this connection's profile and is
+	 * NULL until ESTABLISHED, segments it can't handle take the generic
+	 * path. */
+	struct OptProfile { 
+		unsigned (TCPConnection::*output)(u_char *opt); 
+		bool (TCPConnection::*input)(const u_char *optp, unsigned optlen, 
+					unsigned ti_win, unsigned &tiwin, 
+					int &ts_present, u_long &ts_val, u_long &ts_ecr); 
+	}; 
+	static const OptProfile opt_profiles[2][2]; 	/* [timestamps][scaling] */
+	const OptProfile *_opt_profile; 
+	void		tcp_select_opt_profile(); 
+	template <bool TS> 
+	unsigned	tcp_output_options(u_char *opt); 
+	template <bool TS, bool WS> 
+	bool		tcp_input_options(const u_char *optp, unsigned optlen, 
+					unsigned ti_win, unsigned &tiwin, 
+					int &ts_present, u_long &ts_val, u_long &ts_ecr); 
 	void 		tcp_respond(tcp_seq_t ack, tcp_seq_t seq, int flags);
 	void		tcp_setpersist(); 
 	void		tcp_drop(int err); 
@@ -326,29 +788,162 @@ class TCPConnection : public MultiFlowHandler
 	tcpcb*		tcp_newtcpcb(); 
 	tcp_seq_t	so_recv_buffer_space(); 
 	void 		_do_iphdr(WritablePacket *p);
-	void 		ip_output(WritablePacket *p); 
+	void 		ip_output(WritablePacket *p, uint32_t payload_sum = TCP_CSUM_UNKNOWN); 
 	inline void tcp_set_state(short);
 	inline void print_tcpstats(WritablePacket *p, char *label);
-	short tcp_state() const { return tp->t_state; } 
+	short tcp_state() const { return tp ? tp->t_state : TCPS_CLOSED; } 
 
-	Task		* _stateless_pull; 
-	static bool	pull_stateless_input(Task *, void *); 
 	MFHState        set_state(const MFHState new_state, const int port = -1); 
 
-	void can_pull(const MultiFlowDispatcher * const neighbor, bool pullable ) {
-	        if ( pullable
-		    && dispatcher()->_output_port_neighbors[TCPS_STATELESS_OUTPUT] == neighbor 
-		    && (! _stateless_pull->scheduled())  
-		    && handler_state() == ACTIVE) { 
-			_stateless_pull->reschedule(); 
-		} 
-	}; 
+	void 		can_pull(const MultiFlowDispatcher * const neighbor, bool pullable); 
+};
+
+/* TCP Fast Open (RFC 7413): the option, the length of the cookies we
+ * hand out, and how many server cookies are cached before the cache
+ * starts over */
+#ifndef TCPOPT_FASTOPEN
+# define TCPOPT_FASTOPEN		34
+#endif
+#define TCPOLEN_FASTOPEN_REQ	2
+#define TCP_FASTOPEN_COOKIELEN	8
+#define TCP_FASTOPEN_MINCOOKIE	4
+#define TCP_FASTOPEN_MAXCOOKIE	16
+#define TCP_FASTOPEN_CACHE		4096
+
+/* Metrics of past connections to a peer (RFC 2140), in the units of the
+ * tcpcb fields they seed */
+#define TCP_HOSTCACHE		4096
+#define TCP_HC_MINSAMPLES	2
+#define TCP_HC_MAXIW		10		/* segments, without a cached threshold (RFC 6928) */
+struct tcp_hostcache 
+{ 
+		short	srtt; 		/* as t_srtt, 0 if unknown */
+		short	rttvar; 
+		u_long	ssthresh; 	/* 0 if never lowered */
+		u_long	cwnd; 
+		u_short	mss; 
+		u_long	updates; 
+		u_long	hits; 
+};
+
+/* MESH_CC: the rate controller of the stateless output, and what we
+ * measure of the peer speaker's packets for its controller */
+#define MESH_CC_INTERVAL	50			/* ms between rate changes */
+#define MESH_CC_FBINTERVAL	10			/* ms between feedback-only frames */
+#define MESH_CC_OWDWINDOW	10000		/* ms the lowest delay is kept */
+#define MESH_CC_INITRATE	125000		/* bytes/s */
+#define MESH_CC_MINRATE		12500
+#define MESH_CC_MAXRATE		125000000
+#define MESH_CC_STEP		30000		/* bytes/s added per interval */
+#define MESH_CC_BURST		6000		/* bytes */
+struct tcp_meshcc 
+{ 
+		/* sender */
+		uint16_t	snd_next; 	/* our next hop sequence number */
+		uint32_t	rate; 		/* bytes/s */
+		bool		slowstart; 
+		bool		limited; 	/* output held back since the last change */
+		int64_t		tokens; 	/* bytes, negative while in debt */
+		Timestamp	refill; 
+		Timestamp	adjust; 	/* last rate change */
+		uint16_t	peer_lost; 	/* what the peer reported last */
+		uint16_t	peer_lost_adjust; /* and at the last rate change */
+		uint16_t	peer_qdelay; 
+		bool		peer_any; 
+		IPAddress	dst; 		/* annotation of feedback-only frames */
+		u_long		cuts; 
+		u_long		held; 
+		/* receiver */
+		bool		rcv_any; 
+		uint16_t	rcv_next; 	/* next sequence number expected */
+		uint16_t	rcv_lost; 
+		uint16_t	owd_min; 	/* lowest one way delay, clock offset */
+		uint16_t	owd_min_next; /* included; ..._next for the next window */
+		Timestamp	owd_window; /* when owd_min_next takes over */
+		uint16_t	qdelay; 	/* smoothed, ms */
+		bool		fb_due; 	/* news for the peer not sent yet */
+		Timestamp	fb_sent; 
+};
+
+/* MESH_FEC: a block we send, and the blocks we receive, of which the last
+ * MESH_FEC_RCVBLOCKS are kept. Received packets are XORed into acc as
+ * they come, so the one missing is the repair packet XOR acc. */
+#define MESH_FEC_DELAY		5			/* ms a partial block stays open */
+#define MESH_FEC_MINBLOCK	2
+#define MESH_FEC_MAXBLOCK	32			/* bits in tcp_fecblock::mask */
+#define MESH_FEC_RCVBLOCKS	4
+struct tcp_fecblock 
+{ 
+		uint16_t	block; 
+		bool		used; 
+		bool		done; 		/* repair packet seen */
+		uint32_t	mask; 		/* packets seen */
+		int			count; 
+		uint16_t	lenxor; 
+		u_char		acc[MESH_FEC_MAXLEN]; 
+};
+struct tcp_meshfec 
+{ 
+		/* sender */
+		uint16_t	snd_block; 
+		int			snd_count; 	/* packets in the block so far */
+		int			snd_k; 		/* packets per block */
+		Timestamp	snd_start; 	/* first packet of the block */
+		unsigned	snd_acclen; 	/* longest packet so far */
+		uint16_t	snd_lenxor; 
+		u_char		snd_acc[MESH_FEC_MAXLEN]; 
+		IPAddress	dst; 		/* annotation of repair packets */
+		uint8_t		peer_loss; 	/* what the peer reported last, /256 */
+		/* receiver */
+		uint8_t		rcv_loss; 	/* smoothed, /256 */
+		tcp_fecblock rcv[MESH_FEC_RCVBLOCKS]; 
+};
+
+/* a cookie a server handed us */
+struct tcp_fastopen_cookie 
+{ 
+		uint8_t	len; 
+		u_char	cookie[TCP_FASTOPEN_MAXCOOKIE]; 
+};
+
+/* Per speaker accounting of the lazily allocated per-connection state */
+struct tcp_memstat 
+{
+		u_long	tcpcbs; 
+		u_long	fifo_rings; 
+};
+
+#if TCPSPEAKER_CYCLES
+/* Cycles spent per packet on the datapath, only in profiling builds */
+enum { TCPS_CYC_INPUT, TCPS_CYC_USRSEND, TCPS_CYC_OPTIONS, TCPS_CYC_NSTATS }; 
+struct tcp_cyclestat 
+{
+		uint64_t	count[TCPS_CYC_NSTATS]; 
+		uint64_t	cycles[TCPS_CYC_NSTATS]; 
+};
+#endif
+
+/* Flow completion times of the last TCPS_FCT_SAMPLES closed connections */
+#define TCPS_FCT_SAMPLES	4096
+struct tcp_fctstat 
+{
+		uint32_t	usec[TCPS_FCT_SAMPLES]; 
+		uint64_t	bytes[TCPS_FCT_SAMPLES]; /* sent on the stateless output */
+		int			next; 
+		int			count; 
 };
 
 
-class TCPSpeaker : public MultiFlowDispatcher {
+class TCPSpeaker : public TypedMultiFlowDispatcher<TCPConnection> {
     public:
-	TCPSpeaker() { _ip_id = 0; };
+	TCPSpeaker() { _ip_id = 0; _pull_ready = NULL; _pull_task = NULL; 
+		_gro_list = NULL; _gro_task = NULL; 
+		_mesh_wait = _mesh_wait_tail = NULL; _mesh_timer = NULL; 
+		_mesh_tag_next = 0; 
+		_agg = NULL; _agg_held = NULL; _agg_timer = NULL; 
+		_pace_timer = NULL; _meshcc_timer = NULL; 
+		_arq_list = NULL; _arq_timer = NULL; 
+		_fec_repair = NULL; _fec_timer = NULL; };
 	~TCPSpeaker() { /*TODO delete all sub-datastructures, although this should never happen */ }; 
 
 	const char *class_name() const { return "TCPSpeaker"; }
@@ -357,12 +952,15 @@ class TCPSpeaker : public MultiFlowDispatcher {
 	const char *mfh_processing() const { return "ha/lh"; } 
 	// Flow code xy/xy means packets travel only from port 0 to 0 and from 1 to 1
 	const char *flow_code()  const { return "xy/xy"; } 
+	bool 	run_task(Task *); 
 
 	MultiFlowHandler * new_handler(const IPFlowID & flowid, const int direction) { 
 		return new TCPConnection(this, flowid, direction);
 	}
 
-	bool is_syn(const Packet * packet); 
+	bool is_syn(const int port, const Packet * packet); 
+	void push(int port, Packet *p); 
+	Packet *pull(int port); 
 
 	uint16_t get_and_increment_ip_id() { return htons(++_ip_id); }
 	int 	configure(Vector<String> &conf, ErrorHandler * errh); 
@@ -386,13 +984,34 @@ class TCPSpeaker : public MultiFlowDispatcher {
 
     protected:
 	friend class	TCPConnection; 
+	friend class	TCPFifo; 
 	tcpstat 		_tcpstat; 
+	tcp_memstat		_mem; 
+	tcp_fctstat		_fct; 
+#if TCPSPEAKER_CYCLES
+	tcp_cyclestat	_cycles; 
+#endif
+	void		record_fct(TCPConnection *); 
 
     private: 
 	// Element Handler Methods
 	static String read_verb(Element*, void*);
 	static int write_verb(const String&, Element*, void*, ErrorHandler*);
 	static String read_num_connections(Element*, void*);
+	static String read_memory(Element*, void*);
+	static String read_gro(Element*, void*);
+	static String read_mesh_agg(Element*, void*);
+	static String read_fastopen(Element*, void*);
+	static String read_hostcache(Element*, void*);
+	static String read_mesh_cc(Element*, void*);
+	static String read_mesh_arq(Element*, void*);
+	static String read_mesh_fec(Element*, void*);
+	static String read_fct(Element*, void*);
+	static int write_fct_reset(const String&, Element*, void*, ErrorHandler*);
+#if TCPSPEAKER_CYCLES
+	static String read_cycles(Element*, void*);
+	static int write_cycles(const String&, Element*, void*, ErrorHandler*);
+#endif
 
 	TCPSpeaker 		*_speaker;
 	ErrorHandler	*_errh; 
@@ -404,6 +1023,99 @@ class TCPSpeaker : public MultiFlowDispatcher {
 	Timer			*_fast_ticks;
 	Timer			*_slow_ticks;
 
+	/* Connections with pullable stateless input (MFD_DISPATCH_MFD_DIRECT |
+	 * MFD_DISPATCH_PULL only), linked through TCPConnection::_speaker_queue
+	 * and serviced round robin by the single _pull_task */
+	TCPConnection	*_pull_ready; 
+	Task			*_pull_task; 
+	void		pull_ready_enqueue(TCPConnection *); 
+	void		pull_ready_dequeue(TCPConnection *, int qid); 
+
+	/* Connections holding a GRO segment; _gro_task flushes them all once
+	 * the packets that are there right now have been pushed in */
+	TCPConnection	*_gro_list; 
+	Task			*_gro_task; 
+	void		gro_enqueue(TCPConnection *); 
+	void		gro_dequeue(TCPConnection *); 
+
+	/* Connections holding a partial mesh packet, in deadline order since
+	 * all wait MESH_DELAY; _mesh_timer fires at the first deadline */
+	TCPConnection	*_mesh_wait; 
+	TCPConnection	*_mesh_wait_tail; 
+	Timer			*_mesh_timer; 
+	void		mesh_wait_enqueue(TCPConnection *); 
+	void		mesh_wait_dequeue(TCPConnection *); 
+	void		mesh_wait_expire(); 
+
+	/* MESH_COMPACT: connections by their receive tag, which is all a
+	 * compact mesh packet carries of its flow */
+	HashTable<uint16_t, TCPConnection *>	_mesh_tags; 
+	uint16_t	_mesh_tag_next; 
+	uint16_t	mesh_tag_alloc(TCPConnection *); 
+	void		mesh_push(Packet *); 
+	void		mesh_compact_push(Packet *); 
+
+	/* MESH_AGG: the frame being filled, which has to leave by
+	 * _agg_deadline, and a packet pulled that didn't fit into it */
+	WritablePacket	*_agg; 
+	Packet			*_agg_held; 
+	Timestamp		_agg_deadline; 
+	Timer			*_agg_timer; 
+	Packet		*mesh_agg_pull(); 
+	Packet		*mesh_agg_finish(); 
+	void		mesh_agg_demux(Packet *); 
+
+	/* FASTOPEN: the key our cookies are derived with, and the cookies
+	 * servers handed us, by server address */
+	uint32_t	_tfo_key[4]; 
+	HashTable<uint32_t, tcp_fastopen_cookie>	_tfo_cache; 
+	void		tfo_cookie(uint32_t addr, u_char *cookie); 
+	bool		tfo_cookie_valid(uint32_t addr, const u_char *cookie, int len); 
+	const tcp_fastopen_cookie *tfo_cache_get(uint32_t addr); 
+	void		tfo_cache_set(uint32_t addr, const u_char *cookie, int len); 
+
+	/* MESH_CC: state of the hop to the peer speaker; _meshcc_timer wakes
+	 * the puller once tokens or feedback are due */
+	tcp_meshcc	_meshcc; 
+	Timer		*_meshcc_timer; 
+	bool		mesh_cc_admit(); 
+	void		mesh_cc_wake_at(const Timestamp &t); 
+	void		mesh_hop_stamp(click_meshhop *h); 
+	void		mesh_hop_input(const click_meshhop *h); 
+	Packet		*mesh_cc_feedback(); 
+
+	/* MESH_FEC: the state of both directions, the repair packet to be
+	 * pulled next, and _fec_timer to close a partial block */
+	tcp_meshfec	_fec; 
+	Packet		*_fec_repair; 
+	Timer		*_fec_timer; 
+	Packet		*fec_output(Packet *p); 
+	void		fec_finish_block(); 
+	void		fec_input(Packet *p); 
+	void		fec_deliver(Packet *p); 
+	tcp_fecblock	*fec_block(uint16_t block); 
+
+	/* MESH_ARQ: connections with mesh packets unacknowledged or an
+	 * acknowledgement due, checked every MESH_ARQ_TICK by _arq_timer */
+	TCPConnection	*_arq_list; 
+	Timer		*_arq_timer; 
+	void		arq_enqueue(TCPConnection *); 
+	void		arq_dequeue(TCPConnection *); 
+	void		arq_run(); 
+
+	/* PACING: connections with segments waiting, a binary heap by
+	 * departure time; _pace_timer fires at the first one */
+	Vector<TCPConnection *>	_pace_heap; 
+	Timer		*_pace_timer; 
+	void		pace_insert(TCPConnection *); 
+	void		pace_remove(TCPConnection *); 
+	void		pace_sift(int i); 
+	void		pace_run(); 
+
+	/* HOSTCACHE: metrics by masked peer address */
+	HashTable<uint32_t, tcp_hostcache>	_hostcache; 
+	tcp_hostcache	*hostcache_get(uint32_t addr, bool create); 
+
 	int 		_verbosity;
 	uint16_t 	_ip_id; // incrementally increase IP hdr id across all flows
 	void		run_timer(Timer *); 
@@ -413,11 +1125,24 @@ class TCPSpeaker : public MultiFlowDispatcher {
 
 
 inline TCPSpeaker *
-TCPConnection::speaker() const { return dynamic_cast<TCPSpeaker*>(mfd()); } 
+TCPConnection::speaker() const { return mfd(); } 
 
 inline int
 TCPConnection::verbosity() const { return speaker()->verbosity(); }
 
+/* The send window opened up again: resume pulling if we stopped for it */
+inline void
+TCPConnection::stateless_input_unchoke() { 
+	if (_speaker_queue.qid == SPEAKER_Q_PULL_CHOKED) 
+		speaker()->pull_ready_enqueue(this); 
+	/* MESH_ARQ: what waited for room in the send fifo can go on now,
+	 * the peer has to hear about it */
+	if (! _arq_rq.is_empty() && arq_deliver()) { 
+		_arq_ack_now = true; 
+		set_pullable(TCPS_STATELESS_OUTPUT, true); 
+	}
+}
+
 inline int
 TCPQueue::verbosity() const { return _con->speaker()->verbosity(); }
 
@@ -429,39 +1154,69 @@ inline void
 TCPConnection::tcp_set_state(short state) {
 	    short old = tp->t_state; 
 	    StringAccum sa;
-	    sa << *(flowid()); 
+	    if (debug_enabled(VERB_STATES)) 
+		sa << *(flowid()); 
 	    tp->t_state = state; 
 		debug_output(VERB_STATES, "[%s] Flow: [%s]: State: [%s]->[%s]", speaker()->name().c_str(), sa.c_str(), tcpstates[old], tcpstates[tp->t_state]); 
 
-		/* Set stateless flags which will dispatch the appropriately flagged
-		 * signal packets into the mesh when we enter into one of these
-		 * following states
-		 */
-
-		 /* stateless flags are disabled for now untill a better
-		  * way of handling those is found */
-
+		/* Raise the stateless signals which tell the far side about it
+		 * when we enter into one of these following states: SYN once a
+		 * client connected to us, FIN once our TCP peer is done sending,
+		 * RST if we close without both FINs having been exchanged */
 		switch (state) {
+			case TCPS_SYN_RECEIVED:
+				/* EARLY_CONNECT: the far side connects while we are
+				 * still in the handshake with our client */
+				if (old != TCPS_SYN_SENT && speaker()->globals()->early_connect && 
+					! (tp->t_sl_rcvd & TH_SYN)) 
+					stateless_signal(TH_SYN); 
+				break;
 			case TCPS_ESTABLISHED:
+				tcp_select_opt_profile(); 
+				/* HOSTCACHE: the initial window is taken, a late SYN
+				 * must not set it again */
+				tp->t_hc_cwnd = 0; 
 				set_state(ACTIVE);
+				if (speaker()->_pull_task) 
+					speaker()->pull_ready_enqueue(this); 
+				if (old == TCPS_SYN_RECEIVED && ! (tp->t_sl_rcvd & TH_SYN)) 
+					stateless_signal(TH_SYN); 
+				/* the far side's FIN arrived while we were connecting,
+				 * close the way the FIN signal does and send ours now */
+				if (tp->t_flags & TF_NEEDFIN) { 
+					tp->t_flags &= ~TF_NEEDFIN; 
+					usrclosed(); 
+				}
 				debug_output(VERB_STATES, "[%s] Flow: [%s]: Setting stateless SYN: [%d]", speaker()->name().c_str(), sa.c_str(), tp->t_sl_flags);
 				break;
-	//		case TCPS_CLOSE_WAIT:
+			case TCPS_CLOSE_WAIT:
+			case TCPS_CLOSING:
+			case TCPS_TIME_WAIT:
+				stateless_signal(TH_FIN); 
+				debug_output(VERB_STATES, "[%s] Flow: [%s]: Setting stateless FIN: [%d]", speaker()->name().c_str(), sa.c_str(), tp->t_sl_flags);
+				break;
 			case TCPS_FIN_WAIT_1: 
 			case TCPS_LAST_ACK:
-				// tp->t_sl_flags = TH_FIN;
 				/* 
 				for (int port = 0; port <= 2; port++) 
 				if ( ( output_port_dispatch(port) & MFD_DISPATCH_SCHEDULER) == MFD_DISPATCH_MFD_DIRECT ) { 
 				    static_cast<MultiFlowHandler *>(output(port))->shutdown(output(port).remote_port()); 
 				} 
 				*/
+				/* LAST_ACK straight from ESTABLISHED (FIN_AFTER_TCP_FIN)
+				 * means our peer's FIN just came in */
+				if (state == TCPS_LAST_ACK) 
+					stateless_signal(TH_FIN); 
 				set_state(SHUTDOWN); 
 				debug_output(VERB_STATES, "[%s] Flow: [%s]: Setting stateless FIN: [%d]", speaker()->name().c_str(), sa.c_str(), tp->t_sl_flags);
 				break;
 			case TCPS_CLOSED:
+				if (old != TCPS_CLOSED && speaker()->globals()->hostcache) 
+					tcp_hc_update(); 
 				set_state(CLOSE); 
-				// tp->t_sl_flags = TH_RST;
+				if (! (tp->t_sl_rcvd & TH_RST) && 
+					! ((tp->t_sl_rcvd & TH_FIN) && (tp->t_sl_raised & TH_FIN))) 
+					stateless_signal(TH_RST); 
 				debug_output(VERB_STATES, "[%s] Flow: [%s]: Setting stateless RST: [%d]", speaker()->name().c_str(), sa.c_str(), tp->t_sl_flags);
 				break;
 		}